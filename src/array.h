@@ -24,6 +24,7 @@
 #include <cstddef>
 #include <algorithm>
 #include <iterator>
+#include <vector>
 
 namespace Util
 {
@@ -133,6 +134,113 @@ public:
   inline void operator()(T ptr) const { delete ptr; }
 };
 
+/*
+ * Hash table with open addressing and linear probing, which stores plain
+ * values and doubles in size whenever it would become more than half full.
+ * The default value T() marks unused slots, so it cannot be stored.  How
+ * the values are keyed is left to the functors passed in: hash(key) must
+ * equal hash(value) for the value stored under the key, and equal(value,
+ * key) tells whether the value is the one stored under the key.
+ */
+template <class T>
+class ProbeTable
+{
+private:
+  std::vector<T>  slots_;
+  unsigned int    size_;
+
+  // noncopyable
+  ProbeTable(const ProbeTable<T>&);
+  ProbeTable<T>& operator=(const ProbeTable<T>&);
+
+  inline unsigned int free_slot(unsigned int hash) const;
+
+public:
+  typedef T value_type;
+
+  // The number of slots has to be a power of two.
+  explicit ProbeTable(unsigned int n_slots) : slots_ (n_slots, T()), size_ (0) {}
+
+  unsigned int size() const { return size_; }
+
+  const T& operator[](unsigned int slot) const { return slots_[slot]; }
+
+  inline void swap(ProbeTable<T>& b)
+    { slots_.swap(b.slots_); std::swap(size_, b.size_); }
+
+  inline void clear();
+
+  // Return the slot of the value stored under the key, or else the unused
+  // slot where the value for the key goes.
+  template <class Key, class Hash, class Equal>
+  inline unsigned int find_slot(const Key& key, Hash hash, Equal equal) const;
+
+  // Store the value under the key in the unused slot found for the key, and
+  // return the slot it ended up in, as growing the table moves the values.
+  template <class Key, class Hash>
+  inline unsigned int insert(unsigned int slot, const T& value, const Key& key, Hash hash);
+};
+
+template <class T>
+unsigned int ProbeTable<T>::free_slot(unsigned int hash) const
+{
+  const unsigned int mask = slots_.size() - 1;
+
+  for (unsigned int i = hash;; ++i)
+  {
+    if (slots_[i & mask] == T())
+      return i & mask;
+  }
+}
+
+template <class T>
+void ProbeTable<T>::clear()
+{
+  if (size_ > 0)
+    std::fill(slots_.begin(), slots_.end(), T());
+
+  size_ = 0;
+}
+
+template <class T>
+template <class Key, class Hash, class Equal>
+unsigned int ProbeTable<T>::find_slot(const Key& key, Hash hash, Equal equal) const
+{
+  const unsigned int mask = slots_.size() - 1;
+
+  for (unsigned int i = hash(key);; ++i)
+  {
+    const T& value = slots_[i & mask];
+
+    if (value == T() || equal(value, key))
+      return i & mask;
+  }
+}
+
+template <class T>
+template <class Key, class Hash>
+unsigned int ProbeTable<T>::insert(unsigned int slot, const T& value, const Key& key, Hash hash)
+{
+  if (2 * (size_ + 1) > slots_.size())
+  {
+    std::vector<T> slots (2 * slots_.size(), T());
+    slots.swap(slots_);
+
+    // The values stored are distinct, thus each one can simply go into
+    // the first unused slot on its probe sequence.
+    for (typename std::vector<T>::const_iterator p = slots.begin(); p != slots.end(); ++p)
+      if (!(*p == T()))
+        slots_[free_slot(hash(*p))] = *p;
+
+    slot = free_slot(hash(key));
+  }
+
+  slots_[slot] = value;
+  ++size_;
+
+  return slot;
+}
+
 } // namespace Util
 
 #endif /* SOMATO_ARRAY_H_INCLUDED */
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "assembly.h"
+
+#include <glib.h>
+
+#include <config.h>
+
+namespace
+{
+
+using Somato::Cube;
+using Somato::AssemblyPlanner;
+
+/*
+ * The axis and sign of the movement away from the final position, for
+ * each direction of approach.  Note that the Z axis of the cube points
+ * to the back.
+ */
+static const struct
+{
+  unsigned char axis;
+  signed char   sign;
+}
+movement_data[AssemblyPlanner::DIRECTION_COUNT] =
+{
+  { Cube::AXIS_Y, +1 }, // FROM_TOP
+  { Cube::AXIS_Z, -1 }, // FROM_FRONT
+  { Cube::AXIS_X, -1 }, // FROM_LEFT
+  { Cube::AXIS_X, +1 }, // FROM_RIGHT
+  { Cube::AXIS_Z, +1 }, // FROM_BACK
+  { Cube::AXIS_Y, -1 }  // FROM_BOTTOM
+};
+
+/*
+ * Compute the cells the piece passes through on its way out of the cube,
+ * not counting the cells it occupies in its final position.
+ */
+static
+Cube compute_sweep(Cube piece, int axis, int sign)
+{
+  Cube sweep;
+
+  for (int x = 0; x < Cube::N; ++x)
+    for (int y = 0; y < Cube::N; ++y)
+      for (int z = 0; z < Cube::N; ++z)
+        if (piece.get(x, y, z))
+        {
+          int cell[3] = { x, y, z };
+
+          for (cell[axis] += sign; cell[axis] >= 0 && cell[axis] < Cube::N; cell[axis] += sign)
+            sweep.put(cell[0], cell[1], cell[2], true);
+        }
+
+  return sweep;
+}
+
+} // anonymous namespace
+
+namespace Somato
+{
+
+AssemblyPlanner::AssemblyPlanner()
+:
+  sweeps_       (),
+  dead_ends_    (),
+  piece_sweeps_ ()
+{}
+
+AssemblyPlanner::~AssemblyPlanner()
+{}
+
+const AssemblyPlanner::SweepTable& AssemblyPlanner::get_sweeps(Cube piece)
+{
+  const SweepMap::iterator pos = sweeps_.lower_bound(piece);
+
+  if (pos != sweeps_.end() && pos->first == piece)
+    return pos->second;
+
+  SweepTable table;
+
+  for (int i = 0; i < DIRECTION_COUNT; ++i)
+    table[i] = compute_sweep(piece, movement_data[i].axis, movement_data[i].sign);
+
+  return sweeps_.insert(pos, SweepMap::value_type(piece, table))->second;
+}
+
+bool AssemblyPlanner::plan(const std::vector<Cube>& pieces, std::vector<Step>& steps)
+{
+  steps.clear();
+  dead_ends_.clear();
+  piece_sweeps_.clear();
+
+  Cube cube;
+
+  for (std::vector<Cube>::const_iterator p = pieces.begin(); p != pieces.end(); ++p)
+  {
+    g_return_val_if_fail(*p != Cube() && (cube & *p) == Cube(), false);
+
+    cube |= *p;
+    piece_sweeps_.push_back(get_sweeps(*p).begin());
+  }
+
+  steps.reserve(pieces.size());
+
+  return search(pieces, Cube(), steps);
+}
+
+/*
+ * Depth-first search for an assembly order, starting from the state with
+ * the given cells occupied.  The next piece is always the first one in
+ * order of preference which can be moved in, thus the preferred order is
+ * kept if it is valid.  Which direction a piece comes in from does not
+ * affect the state, hence only the first unobstructed direction is tried.
+ * States without a way forward are remembered, so none is explored twice.
+ */
+bool AssemblyPlanner::search(const std::vector<Cube>& pieces, Cube cube, std::vector<Step>& steps)
+{
+  if (steps.size() == pieces.size())
+    return true;
+
+  if (dead_ends_.find(cube) != dead_ends_.end())
+    return false;
+
+  for (unsigned int i = 0; i < pieces.size(); ++i)
+  {
+    if ((pieces[i] & cube) != Cube())
+      continue;
+
+    const Cube *const sweeps = piece_sweeps_[i];
+
+    for (int d = 0; d < DIRECTION_COUNT; ++d)
+      if ((sweeps[d] & cube) == Cube())
+      {
+        steps.push_back(Step(i, d));
+
+        if (search(pieces, cube | pieces[i], steps))
+          return true;
+
+        steps.pop_back();
+        break;
+      }
+  }
+
+  dead_ends_.insert(cube);
+
+  return false;
+}
+
+} // namespace Somato
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef SOMATO_ASSEMBLY_H_INCLUDED
+#define SOMATO_ASSEMBLY_H_INCLUDED
+
+#include "array.h"
+#include "cube.h"
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <config.h>
+
+namespace Somato
+{
+
+/*
+ * Finds an order in which the pieces of a solution can be put together,
+ * each one slid straight into its place from outside of the cube without
+ * passing through any piece already in place.  The cells swept by each
+ * placement on its way in are memoized, thus once the placements of a
+ * puzzle have been seen, planning boils down to a few mask operations.
+ */
+class AssemblyPlanner
+{
+public:
+  // Directions of approach, in order of preference.
+  enum Direction
+  {
+    FROM_TOP,
+    FROM_FRONT,
+    FROM_LEFT,
+    FROM_RIGHT,
+    FROM_BACK,
+    FROM_BOTTOM,
+    DIRECTION_COUNT
+  };
+
+  struct Step
+  {
+    int piece;      // index into the pieces passed to plan()
+    int direction;  // Direction the piece is moved in from
+
+    Step() : piece (0), direction (FROM_TOP) {}
+    Step(int p, int d) : piece (p), direction (d) {}
+  };
+
+  AssemblyPlanner();
+  ~AssemblyPlanner();
+
+  // The pieces are listed in the preferred order of assembly, which is
+  // kept as far as possible.  Returns false if there is no valid order.
+  bool plan(const std::vector<Cube>& pieces, std::vector<Step>& steps);
+
+private:
+  typedef Util::Array<Cube, DIRECTION_COUNT>               SweepTable;
+  typedef std::map<Cube, SweepTable, Cube::SortPredicate>  SweepMap;
+  typedef std::set<Cube, Cube::SortPredicate>              CubeSet;
+
+  SweepMap                  sweeps_;
+  CubeSet                   dead_ends_;
+  std::vector<const Cube*>  piece_sweeps_;
+
+  // noncopyable
+  AssemblyPlanner(const AssemblyPlanner&);
+  AssemblyPlanner& operator=(const AssemblyPlanner&);
+
+  const SweepTable& get_sweeps(Cube piece);
+
+  bool search(const std::vector<Cube>& pieces, Cube cube, std::vector<Step>& steps);
+};
+
+} // namespace Somato
+
+#endif /* SOMATO_ASSEMBLY_H_INCLUDED */
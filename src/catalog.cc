@@ -0,0 +1,396 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "catalog.h"
+#include "solver.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include <config.h>
+
+namespace
+{
+
+using Somato::Cube;
+
+// Number of figures counted by each job of the work queue.
+enum { JOB_SIZE = 16 * Somato::PuzzleSolver::MAX_BATCH_SIZE };
+
+/*
+ * The first line of a checkpoint file, which identifies the pieces.
+ * The figures follow one per line, as hexadecimal masks along with
+ * their solution counts.
+ */
+static
+std::string format_header(const std::vector<Cube>& pieces)
+{
+  std::string header = "somato-catalog 1";
+
+  for (std::vector<Cube>::const_iterator p = pieces.begin(); p != pieces.end(); ++p)
+  {
+    gchar buffer[16];
+    g_snprintf(buffer, sizeof buffer, " %07x", p->to_bits());
+    header += buffer;
+  }
+
+  return header + '\n';
+}
+
+static
+void sort_unique(std::vector<Cube>& store)
+{
+  std::sort(store.begin(), store.end(), Cube::SortPredicate());
+  store.erase(std::unique(store.begin(), store.end()), store.end());
+}
+
+} // anonymous namespace
+
+namespace Somato
+{
+
+struct ShapeCatalog::CountJob
+{
+  ShapeCatalog*     catalog;
+  std::vector<int>  indices;
+  std::vector<Cube> figures;
+  std::vector<int>  counts;
+};
+
+ShapeCatalog::ShapeCatalog()
+:
+  pieces_         (),
+  entries_        (),
+  checkpoint_     (),
+  interval_       (60.0),
+  done_count_     (0),
+  cancelled_      (0),
+  mirror_merged_  (false)
+{}
+
+ShapeCatalog::~ShapeCatalog()
+{}
+
+void ShapeCatalog::add_piece(Cube piece)
+{
+  g_return_if_fail(piece != Cube());
+
+  pieces_.push_back(canonical_piece(piece));
+}
+
+void ShapeCatalog::clear_pieces()
+{
+  pieces_.clear();
+}
+
+void ShapeCatalog::set_checkpoint(const std::string& filename, double interval)
+{
+  checkpoint_ = filename;
+  interval_   = interval;
+}
+
+void ShapeCatalog::cancel()
+{
+  g_atomic_int_set(&cancelled_, 1);
+}
+
+/*
+ * Mirror images of figures can only be merged if the set of pieces maps
+ * onto itself under reflection, which then carries over the solutions.
+ */
+Cube ShapeCatalog::canonical_shape(Cube figure) const
+{
+  const Cube shape = canonical_figure(figure);
+
+  if (!mirror_merged_)
+    return shape;
+
+  return std::min(shape, canonical_figure(figure.mirror(Cube::AXIS_X)),
+                  Cube::SortPredicate());
+}
+
+/*
+ * Add the pieces one at a time to every partial figure found so far.
+ * Each piece may go anywhere within the cube, thus partial figures which
+ * are rotations of each other lead to rotated figures in the end and
+ * only one of them needs to be kept.  Reflections cannot be merged at
+ * this stage, since the remaining pieces need not be mirror-symmetric.
+ */
+void ShapeCatalog::enumerate_figures()
+{
+  std::vector<Cube> level (1, Cube());
+  std::vector<Cube> next;
+  PieceStore        placements;
+
+  for (std::vector<Cube>::const_iterator piece = pieces_.begin(); piece != pieces_.end(); ++piece)
+  {
+    placements.clear();
+    find_placements(*piece, ~Cube(), placements);
+
+    next.clear();
+
+    for (std::vector<Cube>::const_iterator p = level.begin(); p != level.end(); ++p)
+      for (PieceStore::const_iterator q = placements.begin(); q != placements.end(); ++q)
+        if ((*p & *q) == Cube())
+          next.push_back(*p | *q);
+
+    // Weed out the duplicates before paying for the canonical forms.
+    sort_unique(next);
+    std::transform(next.begin(), next.end(), next.begin(), &canonical_figure);
+    sort_unique(next);
+
+    level.swap(next);
+  }
+
+  for (std::vector<Cube>::iterator p = level.begin(); p != level.end(); ++p)
+    *p = canonical_shape(*p);
+
+  sort_unique(level);
+
+  entries_.resize(level.size());
+
+  for (unsigned int i = 0; i < level.size(); ++i)
+  {
+    entries_[i].figure = level[i];
+    entries_[i].count  = -1;
+  }
+
+  done_count_ = 0;
+}
+
+/*
+ * Run the work queue of solution counts.  Jobs go to a thread pool and
+ * come back through an asynchronous queue to the calling thread, which
+ * alone updates the catalog and saves checkpoints in between.
+ */
+bool ShapeCatalog::run(int n_threads, std::string& error)
+{
+  g_return_val_if_fail(!pieces_.empty(), false);
+
+  g_atomic_int_set(&cancelled_, 0);
+
+  std::vector<Cube> mirrored;
+
+  for (std::vector<Cube>::const_iterator p = pieces_.begin(); p != pieces_.end(); ++p)
+    mirrored.push_back(canonical_piece(Cube(*p).mirror(Cube::AXIS_X)));
+
+  std::vector<Cube> pieces (pieces_);
+
+  std::sort(pieces.begin(), pieces.end(), Cube::SortPredicate());
+  std::sort(mirrored.begin(), mirrored.end(), Cube::SortPredicate());
+
+  mirror_merged_ = (pieces == mirrored);
+
+  if (!load_checkpoint())
+  {
+    enumerate_figures();
+
+    if (!checkpoint_.empty() && !save_checkpoint(error))
+      return false;
+  }
+
+  std::vector<CountJob*> jobs;
+
+  for (unsigned int i = 0; i < entries_.size(); ++i)
+    if (entries_[i].count < 0)
+    {
+      if (jobs.empty() || jobs.back()->indices.size() == JOB_SIZE)
+      {
+        jobs.push_back(new CountJob());
+        jobs.back()->catalog = this;
+      }
+      jobs.back()->indices.push_back(i);
+      jobs.back()->figures.push_back(entries_[i].figure);
+    }
+
+  GAsyncQueue* results = 0;
+  GThreadPool* pool    = 0;
+
+  if (n_threads > 1 && g_thread_supported() && !jobs.empty())
+  {
+    results = g_async_queue_new();
+    pool    = g_thread_pool_new(&ShapeCatalog::execute_job, results, n_threads, FALSE, 0);
+  }
+
+  if (pool)
+    for (unsigned int i = 0; i < jobs.size(); ++i)
+      g_thread_pool_push(pool, jobs[i], 0);
+
+  GTimer *const timer = g_timer_new();
+  bool saved = true;
+
+  for (unsigned int i = 0; i < jobs.size(); ++i)
+  {
+    CountJob* job = jobs[i];
+
+    if (pool)
+      job = static_cast<CountJob*>(g_async_queue_pop(results));
+    else
+      execute_job(job, 0);
+
+    finish_job(job);
+
+    if (saved && !checkpoint_.empty() && g_timer_elapsed(timer, 0) >= interval_)
+    {
+      // Stop early rather than lose more work if saving fails.
+      if (!(saved = save_checkpoint(error)))
+        cancel();
+
+      g_timer_start(timer);
+    }
+  }
+
+  g_timer_destroy(timer);
+
+  if (pool)
+  {
+    g_thread_pool_free(pool, FALSE, TRUE);
+    g_async_queue_unref(results);
+  }
+
+  if (saved && !checkpoint_.empty())
+    saved = save_checkpoint(error);
+
+  return (saved && done_count_ == int(entries_.size()));
+}
+
+// static
+void ShapeCatalog::execute_job(void* data, void* user_data)
+{
+  CountJob *const     job     = static_cast<CountJob*>(data);
+  ShapeCatalog *const catalog = job->catalog;
+  const int           n       = job->figures.size();
+
+  job->counts.assign(n, -1);
+
+  PuzzleSolver solver;
+
+  for (std::vector<Cube>::const_iterator p = catalog->pieces_.begin();
+       p != catalog->pieces_.end(); ++p)
+    solver.add_piece(*p);
+
+  // Check for cancellation between the batches, but keep the counts of
+  // a batch only if it ran to completion.
+  for (int i = 0; i < n && !g_atomic_int_get(&catalog->cancelled_); i += PuzzleSolver::MAX_BATCH_SIZE)
+  {
+    const int m = std::min(n - i, int(PuzzleSolver::MAX_BATCH_SIZE));
+    int counts[PuzzleSolver::MAX_BATCH_SIZE];
+
+    if (solver.count_batch(&job->figures[i], m, counts))
+      std::copy(counts, counts + m, &job->counts[i]);
+  }
+
+  if (user_data)
+    g_async_queue_push(static_cast<GAsyncQueue*>(user_data), job);
+}
+
+void ShapeCatalog::finish_job(CountJob* job)
+{
+  for (unsigned int i = 0; i < job->indices.size(); ++i)
+    if (job->counts[i] >= 0)
+    {
+      entries_[job->indices[i]].count = job->counts[i];
+      ++done_count_;
+    }
+
+  delete job;
+}
+
+/*
+ * Restore the catalog from the checkpoint file, if there is one for the
+ * same pieces.  Anything unexpected in the file voids it as a whole.
+ */
+bool ShapeCatalog::load_checkpoint()
+{
+  gchar* contents = 0;
+
+  if (checkpoint_.empty() || !g_file_get_contents(checkpoint_.c_str(), &contents, 0, 0))
+    return false;
+
+  const std::string header = format_header(pieces_);
+
+  EntryStore  entries;
+  int         n_done = 0;
+  bool        valid  = (std::strncmp(contents, header.c_str(), header.size()) == 0);
+  const char* p      = contents + header.size();
+
+  while (valid && *p != '\0')
+  {
+    char* end = 0;
+    Entry entry;
+
+    entry.figure = Cube::from_bits(std::strtoul(p, &end, 16));
+    valid = (end != p && *end == ' ');
+
+    if (valid)
+    {
+      p = end + 1;
+      entry.count = std::strtol(p, &end, 10);
+      valid = (end != p && *end == '\n' && entry.count >= -1);
+      p = end + 1;
+    }
+
+    if (valid)
+    {
+      n_done += (entry.count >= 0);
+      entries.push_back(entry);
+    }
+  }
+
+  g_free(contents);
+
+  if (!valid || entries.empty())
+    return false;
+
+  entries_.swap(entries);
+  done_count_ = n_done;
+
+  return true;
+}
+
+bool ShapeCatalog::save_checkpoint(std::string& error) const
+{
+  std::string contents = format_header(pieces_);
+
+  contents.reserve(contents.size() + 16 * entries_.size());
+
+  for (EntryStore::const_iterator p = entries_.begin(); p != entries_.end(); ++p)
+  {
+    gchar buffer[32];
+    g_snprintf(buffer, sizeof buffer, "%07x %d\n", p->figure.to_bits(), p->count);
+    contents += buffer;
+  }
+
+  GError* gerror = 0;
+
+  // The file is replaced atomically, so an interrupted save leaves the
+  // previous checkpoint intact.
+  if (!g_file_set_contents(checkpoint_.c_str(), contents.data(), contents.size(), &gerror))
+  {
+    error = gerror->message;
+    g_error_free(gerror);
+    return false;
+  }
+
+  return true;
+}
+
+} // namespace Somato
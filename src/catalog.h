@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOMATO_CATALOG_H_INCLUDED
+#define SOMATO_CATALOG_H_INCLUDED
+
+#include "cube.h"
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+#include <config.h>
+
+namespace Somato
+{
+
+/*
+ * Catalog of all distinct figures within the cube which a set of pieces
+ * can be assembled into, together with the number of solutions of each
+ * as count() reports it.  Figures are distinct up to rotation, and also
+ * up to reflection if the set of pieces is its own mirror image.
+ *
+ * Since a catalog may take hours to complete, the progress can be saved
+ * to a checkpoint file, from which a later run() with the same pieces
+ * continues.  Apart from cancel(), methods must not be called while
+ * run() is in progress.
+ */
+class ShapeCatalog
+{
+public:
+  struct Entry
+  {
+    Cube figure;  // least of the figures equivalent to it
+    int  count;   // number of solutions, or -1 if not counted yet
+  };
+
+  typedef std::vector<Entry> EntryStore;
+
+  ShapeCatalog();
+  ~ShapeCatalog();
+
+  void add_piece(Cube piece);
+  void clear_pieces();
+
+  // Save the progress at most every interval seconds, and at the end.
+  void set_checkpoint(const std::string& filename, double interval);
+
+  // Returns false if cancelled or if the checkpoint could not be saved,
+  // in which case the error message is set.  The counts are distributed
+  // to n_threads threads, if the GLib thread system has been initialized.
+  bool run(int n_threads, std::string& error);
+  void cancel();
+
+  bool get_mirror_merged() const { return mirror_merged_; }
+  int  get_done_count() const { return done_count_; }
+
+  const EntryStore& get_entries() const { return entries_; }
+
+private:
+  struct CountJob;
+
+  std::vector<Cube> pieces_;
+  EntryStore        entries_;
+  std::string       checkpoint_;
+  double            interval_;
+  int               done_count_;
+  volatile gint     cancelled_;
+  bool              mirror_merged_;
+
+  // noncopyable
+  ShapeCatalog(const ShapeCatalog&);
+  ShapeCatalog& operator=(const ShapeCatalog&);
+
+  Cube canonical_shape(Cube figure) const;
+  void enumerate_figures();
+  void finish_job(CountJob* job);
+
+  bool load_checkpoint();
+  bool save_checkpoint(std::string& error) const;
+
+  static void execute_job(void* data, void* user_data);
+};
+
+} // namespace Somato
+
+#endif /* SOMATO_CATALOG_H_INCLUDED */
@@ -106,4 +106,22 @@ Cube& Cube::shift(int axis, bool clip)
   return *this;
 }
 
+Cube& Cube::mirror(int axis)
+{
+  static const unsigned char stride[3] = { N*N, N, 1 };
+
+  const int step   = stride[axis];
+  Bits      result = 0;
+
+  // Move each cell from layer c along the axis to layer N-1-c.
+  for (int i = 0; i < N*N*N; ++i)
+  {
+    const int layer = i / step % N;
+    result |= ((data_ >> i) & Bits(1)) << (i + (N - 1 - 2 * layer) * step);
+  }
+
+  data_ = result;
+  return *this;
+}
+
 } // namespace Somato
@@ -29,12 +29,18 @@ class Cube
 public:
   class SortPredicate;
 
+  // Bit N*N*x + N*y + z represents cell (x, y, z).
+  typedef unsigned int Bits;
+
   enum { N = 3 };
   enum { AXIS_X = 0, AXIS_Y = 1, AXIS_Z = 2 };
 
   inline Cube();
   explicit inline Cube(const bool data[N][N][N]);
 
+  static inline Cube from_bits(Bits data);
+  inline Bits to_bits() const;
+
   inline void clear();
   inline bool empty() const;
 
@@ -44,6 +50,7 @@ public:
 
   Cube& rotate(int axis);                   // clockwise rotation
   Cube& shift(int axis, bool clip = false); // rightward shifting
+  Cube& mirror(int axis);                   // reflection across the middle
 
   inline Cube& operator&=(Cube other);
   inline Cube& operator|=(Cube other);
@@ -56,8 +63,6 @@ public:
   friend inline bool operator!=(Cube a, Cube b);
 
 private:
-  typedef unsigned int Bits;
-
   Bits data_;
 
   explicit inline Cube(Bits data);
@@ -92,6 +97,19 @@ Cube::Cube(const bool data[Cube::N][Cube::N][Cube::N])
   data_ (Cube::from_array(data))
 {}
 
+// static
+inline
+Cube Cube::from_bits(Cube::Bits data)
+{
+  return Cube(data & ~(~Bits(1) << (N*N*N - 1)));
+}
+
+inline
+Cube::Bits Cube::to_bits() const
+{
+  return data_;
+}
+
 inline
 void Cube::clear()
 {
@@ -92,6 +92,36 @@ static const float hide_cursor_delay = 5.0;
  */
 static const float cube_cell_size = 1.0;
 
+/*
+ * Maximum number of worker threads to tesselate the cube pieces on.
+ */
+static const int tesselation_thread_count = 4;
+
+/*
+ * Number of elements in the piece buffers beyond which the shapes no longer
+ * in use are dropped on the next rebuild.  This is half the range of the
+ * 16-bit indices, which leaves the other half to the shapes of a puzzle.
+ */
+enum { ATLAS_ELEMENT_LIMIT = 32768 };
+
+/*
+ * The levels of detail of the pieces, by the number of slices of their
+ * rounded edges.  Each level is used down to the size in pixels which a
+ * cube cell takes up on screen at the center of the view.
+ */
+struct PieceDetail
+{
+  int   edge_slices;
+  float min_cell_pixels;
+};
+
+static const PieceDetail piece_details[Somato::PIECE_LOD_COUNT] =
+{
+  { 3, 64.0 },
+  { 2, 32.0 },
+  { 1,  0.0 }
+};
+
 /*
  * View offset in the direction of the z-axis.
  */
@@ -150,64 +180,10 @@ void gl_set_piece_material(unsigned int cube_index)
   glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR,            material.specular);
 }
 
-/*
- * Find the direction from which a cube piece can be shifted into
- * its desired position, without colliding with any other piece
- * already in place (think Tetris).
- */
-static
-void find_animation_axis(Cube cube, Cube piece, float* direction)
+static inline
+bool equal_matrices(const Math::Matrix4& a, const Math::Matrix4& b)
 {
-  static const struct
-  {
-    // The axis index to be passed to Cube::shift() (X, Y or Z).
-    unsigned char axis;
-
-    // If true, pass the (actually fixed) cube rather than the piece to be
-    // animated to Cube::shift().  As a result the piece appears to "move"
-    // into the opposite direction, without the need to introduce a second
-    // Cube::shift() method.
-    bool backward;
-
-    // The starting point of the animation relative to the final position
-    // of the cube piece.  In other words, (x, y, z) is the reverse of the
-    // vector describing the direction of movement.
-    float x, y, z;
-  }
-  movement_data[] = // directions listed first are prefered
-  {
-    { Cube::AXIS_Y, false,  0.0,  1.0,  0.0 }, // top->down
-    { Cube::AXIS_Z, true,   0.0,  0.0,  1.0 }, // front->back
-    { Cube::AXIS_X, true,  -1.0,  0.0,  0.0 }, // left->right
-    { Cube::AXIS_X, false,  1.0,  0.0,  0.0 }, // right->left
-    { Cube::AXIS_Z, false,  0.0,  0.0, -1.0 }, // back->front
-    { Cube::AXIS_Y, true,   0.0, -1.0,  0.0 }  // bottom->up
-  };
-
-  for (unsigned int i = 0; i < G_N_ELEMENTS(movement_data); ++i)
-  {
-    // Swap fixed and moving pieces if backward shifting is indicated.
-    const Cube fixed  = (movement_data[i].backward) ? piece : cube;
-    Cube       moving = (movement_data[i].backward) ? cube : piece;
-
-    // Now do the shifting until the moving piece has either
-    // vanished from view or collided with the fixed piece.
-    do
-    {
-      if (moving == Cube()) // if it vanished we have just found our solution
-      {
-        direction[0] = movement_data[i].x;
-        direction[1] = movement_data[i].y;
-        direction[2] = movement_data[i].z;
-        return;
-      }
-      moving.shift(movement_data[i].axis, true);
-    }
-    while ((fixed & moving) == Cube());
-  }
-
-  // This should not happen as long as the input is correct.
-  g_return_if_reached();
+  return std::equal(a[0], a[0] + 16, b[0]);
 }
 
 } // anonymous namespace
@@ -230,6 +206,7 @@ public:
   bool have_draw_range_elements;
   bool have_multi_draw_arrays;
   bool have_depth_clamp;
+  bool have_rescale_normal;
 
   PFNGLDRAWRANGEELEMENTSPROC  DrawRangeElements;
   PFNGLMULTIDRAWARRAYSPROC    MultiDrawArrays;
@@ -248,6 +225,7 @@ void CubeScene::Extensions::query()
   have_draw_range_elements     = false;
   have_multi_draw_arrays       = false;
   have_depth_clamp             = false;
+  have_rescale_normal          = false;
 
   DrawRangeElements = 0;
   MultiDrawArrays   = 0;
@@ -284,6 +262,9 @@ void CubeScene::Extensions::query()
   {
     have_depth_clamp = true;
   }
+
+  if (have_version(1, 2) || have_extension("GL_EXT_rescale_normal"))
+    have_rescale_normal = true;
 }
 
 inline
@@ -297,6 +278,8 @@ CubeScene::CubeScene()
   rotation_               (),
 
   cube_pieces_            (),
+  assembly_planner_       (),
+  piece_caches_           (),
   animation_data_         (),
   piece_cells_            (Cube::N * Cube::N * Cube::N),
   depth_order_            (),
@@ -311,9 +294,12 @@ CubeScene::CubeScene()
   footing_                (create_layout_texture()),
 
   cube_texture_           (0),
+  atlas_shapes_           (),
+  atlas_meshes_           (),
   wireframe_list_         (0),
   piece_list_base_        (0),
   piece_list_count_       (0),
+  piece_lod_              (0),
 
   track_last_x_           (TRACK_UNSET),
   track_last_y_           (TRACK_UNSET),
@@ -830,6 +816,21 @@ void CubeScene::gl_update_projection()
   // This way, we can avoid GL_NORMALIZE without having to recompute the whole
   // vertex data everytime after a zoom operation.
   glScalef(zoom_, zoom_, zoom_);
+
+  // Rounded edges only a few pixels across cannot show off their slices,
+  // so pick the coarsest level of detail that still looks the same.
+  const double cell_pixels = cube_cell_size * zoom_ * height / (2.0 * top * -view_z_offset);
+
+  int lod = 0;
+
+  while (lod + 1 < PIECE_LOD_COUNT && cell_pixels < piece_details[lod].min_cell_pixels)
+    ++lod;
+
+  if (lod != piece_lod_)
+  {
+    piece_lod_ = lod;
+    update_piece_ranges();
+  }
 }
 
 void CubeScene::on_size_allocate(Gtk::Allocation& allocation)
@@ -1029,6 +1030,8 @@ void CubeScene::gl_reposition_layouts()
  * the puzzle can be put together without two pieces blocking each other.
  * Also, the puzzle should be put together in a way that appears natural
  * to the human observer, i.e. without inserting pieces from below etc.
+ * The cell order below defines the natural order, which the assembly
+ * planner departs from only where it would lead to a collision.
  *
  * This is one of the few places that are closely tied to the specific
  * application of animating the Soma cube puzzle.  Generalizing the code
@@ -1046,53 +1049,81 @@ void CubeScene::update_animation_order()
     {0,2,2}, {2,2,0}, {0,1,0}, {0,2,1}, {1,2,0}, {0,2,0}
   };
 
-  unsigned int count = 0;
-  Cube         cube;
+  // The starting point of the animation relative to the final position
+  // of the cube piece, for each direction of approach.  In other words,
+  // (x, y, z) is the reverse of the vector describing the movement.
+  static const float movement_data[AssemblyPlanner::DIRECTION_COUNT][3] =
+  {
+    {  0.0,  1.0,  0.0 }, // top->down
+    {  0.0,  0.0,  1.0 }, // front->back
+    { -1.0,  0.0,  0.0 }, // left->right
+    {  1.0,  0.0,  0.0 }, // right->left
+    {  0.0,  0.0, -1.0 }, // back->front
+    {  0.0, -1.0,  0.0 }  // bottom->up
+  };
+
+  // List the cube pieces in the order their cells are first encountered.
+  std::vector<Cube>         pieces;
+  std::vector<unsigned int> cube_indices;
+
+  pieces.reserve(cube_pieces_.size());
+  cube_indices.reserve(cube_pieces_.size());
 
   for (unsigned int i = 0; i < G_N_ELEMENTS(order); ++i)
   {
-    const unsigned int cell_index = N*N * order[i][0] + N * order[i][1] + order[i][2];
-
     Cube cell;
     cell.put(order[i][0], order[i][1], order[i][2], true);
 
-    g_return_if_fail(cell_index < piece_cells_.size());
-
-    piece_cells_[cell_index].piece = G_MAXUINT;
-    piece_cells_[cell_index].cell  = cell_index;
-
-    // 1) Find the cube piece which occupies this cell.
-    // 2) Look it up in the already processed range of the animation data.
-    // 3) If not processed yet, generate and store a new animation data element.
-    // 4) Write the piece's animation index to the piece cells vector.
-
     const std::vector<Cube>::iterator pcube = std::find_if(cube_pieces_.begin(), cube_pieces_.end(),
                                                            Util::DoesIntersect<Cube>(cell));
-    if (pcube != cube_pieces_.end())
+    if (pcube != cube_pieces_.end()
+        && std::find(pieces.begin(), pieces.end(), *pcube) == pieces.end())
     {
-      const unsigned int cube_index = pcube - cube_pieces_.begin();
-      unsigned int       anim_index = 0;
+      pieces.push_back(*pcube);
+      cube_indices.push_back(pcube - cube_pieces_.begin());
+    }
+  }
 
-      while (anim_index < count && animation_data_[anim_index].cube_index != cube_index)
-        ++anim_index;
+  g_return_if_fail(pieces.size() == animation_data_.size()); // invalid input
 
-      if (anim_index == count)
-      {
-        g_return_if_fail((cube & *pcube) == Cube());           // collision
-        g_return_if_fail(anim_index < animation_data_.size()); // invalid input
+  std::vector<AssemblyPlanner::Step> steps;
 
-        animation_data_[anim_index].cube_index = cube_index;
-        find_animation_axis(cube, *pcube, animation_data_[anim_index].direction);
+  if (!assembly_planner_.plan(pieces, steps))
+  {
+    g_warning("No collision-free assembly order found");
 
-        cube |= *pcube;
-        ++count;
-      }
+    steps.clear();
 
-      piece_cells_[cell_index].piece = anim_index;
-    }
+    for (unsigned int i = 0; i < pieces.size(); ++i)
+      steps.push_back(AssemblyPlanner::Step(i, AssemblyPlanner::FROM_TOP));
   }
 
-  g_return_if_fail(count == animation_data_.size()); // invalid input
+  std::vector<unsigned int> anim_indices (cube_pieces_.size(), G_MAXUINT);
+
+  for (unsigned int i = 0; i < steps.size(); ++i)
+  {
+    const unsigned int cube_index = cube_indices[steps[i].piece];
+    const float *const direction  = movement_data[steps[i].direction];
+
+    animation_data_[i].cube_index = cube_index;
+    std::copy(direction, direction + 3, animation_data_[i].direction);
+
+    anim_indices[cube_index] = i;
+  }
+
+  for (unsigned int cell_index = 0; cell_index < N*N*N; ++cell_index)
+  {
+    g_return_if_fail(cell_index < piece_cells_.size());
+
+    const Cube cell = Cube::from_bits(Cube::Bits(1) << cell_index);
+
+    const std::vector<Cube>::iterator pcube = std::find_if(cube_pieces_.begin(), cube_pieces_.end(),
+                                                           Util::DoesIntersect<Cube>(cell));
+
+    piece_cells_[cell_index].piece = (pcube != cube_pieces_.end())
+                                     ? anim_indices[pcube - cube_pieces_.begin()] : G_MAXUINT;
+    piece_cells_[cell_index].cell  = cell_index;
+  }
 
   depth_order_changed_ = true;
 }
@@ -1152,6 +1183,57 @@ void CubeScene::update_depth_order()
   depth_order_changed_ = false;
 }
 
+/*
+ * Determine the pose of each piece, and the index of its shape in the list
+ * of distinct shapes.  All placements of a shape share the same geometry,
+ * which is tesselated once in the canonical pose.  Shapes not in the list
+ * yet are appended to it, in which case true is returned.
+ */
+bool CubeScene::update_piece_meshes(std::vector<Cube>& shapes)
+{
+  const unsigned int shape_count = shapes.size();
+
+  for (std::vector<AnimationData>::iterator p = animation_data_.begin();
+       p != animation_data_.end(); ++p)
+  {
+    g_return_val_if_fail(p->cube_index < cube_pieces_.size(), false);
+
+    const Cube shape = find_piece_pose(cube_pieces_[p->cube_index], p->pose);
+
+    p->mesh_index = std::find(shapes.begin(), shapes.end(), shape) - shapes.begin();
+
+    if (p->mesh_index == shapes.size())
+      shapes.push_back(shape);
+  }
+
+  return (shapes.size() > shape_count);
+}
+
+/*
+ * Point the pieces to the geometry of their shapes at the level of detail
+ * in use, once the meshes are in place.
+ */
+void CubeScene::update_piece_ranges()
+{
+  for (std::vector<AnimationData>::iterator p = animation_data_.begin();
+       p != animation_data_.end(); ++p)
+  {
+    const unsigned int index = PIECE_LOD_COUNT * p->mesh_index + piece_lod_;
+
+    if (index < atlas_meshes_.size())
+    {
+      const PieceMesh& mesh = atlas_meshes_[index];
+
+      p->triangle_count = mesh.triangle_count;
+      p->indices_offset = mesh.indices_offset;
+      p->element_first  = mesh.element_first;
+      p->element_last   = mesh.element_last;
+
+      std::copy(mesh.face_ends, mesh.face_ends + CUBE_FACE_COUNT, p->face_ends);
+    }
+  }
+}
+
 void CubeScene::advance_animation()
 {
   if (frame_trigger_.connected())
@@ -1633,21 +1715,100 @@ void CubeScene::gl_translate_animated_piece(const float* direction) const
   glTranslatef(direction[0] * d, direction[1] * d, direction[2] * d);
 }
 
-void CubeScene::gl_draw_piece_elements(const AnimationData& data) const
+void CubeScene::gl_draw_piece_triangles(const AnimationData& data, unsigned int first,
+                                        unsigned int count, const Math::Matrix4& texmatrix) const
 {
-  gl_set_piece_material(data.cube_index);
+  const unsigned int offset = data.indices_offset + first;
+
+  glMatrixMode(GL_TEXTURE);
+  glPushMatrix();
+  glMultMatrixf(texmatrix[0]);
+  glMatrixMode(GL_MODELVIEW);
 
   if (gl_ext()->have_draw_range_elements)
   {
     gl_ext()->DrawRangeElements(GL_TRIANGLES, data.element_first, data.element_last,
-                                3 * data.triangle_count, CUBE_INDEX_TYPE,
-                                GL::buffer_offset(data.indices_offset * sizeof(CubeIndex)));
+                                count, CUBE_INDEX_TYPE,
+                                GL::buffer_offset(offset * sizeof(CubeIndex)));
   }
   else
   {
-    glDrawElements(GL_TRIANGLES, 3 * data.triangle_count, CUBE_INDEX_TYPE,
-                   GL::buffer_offset(data.indices_offset * sizeof(CubeIndex)));
+    glDrawElements(GL_TRIANGLES, count, CUBE_INDEX_TYPE,
+                   GL::buffer_offset(offset * sizeof(CubeIndex)));
+  }
+
+  glMatrixMode(GL_TEXTURE);
+  glPopMatrix();
+  glMatrixMode(GL_MODELVIEW);
+}
+
+/*
+ * The flat faces of each direction need a texture matrix of their own to
+ * keep the texture in line with the cube grid, while the rounded edges and
+ * corners at the end need none.  Consecutive parts that share a matrix,
+ * as all of them do in the canonical orientation, are drawn together.
+ */
+void CubeScene::gl_draw_piece_elements(const AnimationData& data) const
+{
+  gl_set_piece_material(data.cube_index);
+
+  const float scale = cube_cell_size / PACKED_ELEMENT_UNIT;
+
+  glPushMatrix();
+  glMultMatrixf(get_pose_matrix(data.pose, cube_cell_size)[0]);
+  glScalef(scale, scale, scale);
+
+  Math::Matrix4 texmatrix = get_pose_texture_matrix(data.pose, 0);
+  unsigned int  first     = 0;
+
+  for (int face = 1; face <= CUBE_FACE_COUNT; ++face)
+  {
+    const Math::Matrix4 next = (face < CUBE_FACE_COUNT) ? get_pose_texture_matrix(data.pose, face)
+                                                        : Math::Matrix4();
+    if (!equal_matrices(next, texmatrix))
+    {
+      const unsigned int last = data.face_ends[face - 1];
+
+      if (last > first)
+        gl_draw_piece_triangles(data, first, last - first, texmatrix);
+
+      texmatrix = next;
+      first     = last;
+    }
+  }
+
+  gl_draw_piece_triangles(data, first, 3 * data.triangle_count - first, texmatrix);
+
+  glPopMatrix();
+}
+
+void CubeScene::gl_draw_piece_list(const AnimationData& data) const
+{
+  gl_set_piece_material(data.cube_index);
+
+  glPushMatrix();
+  glMultMatrixf(get_pose_matrix(data.pose, cube_cell_size)[0]);
+
+  // There is one list for the flat faces of each direction, which are drawn
+  // with a texture matrix of their own, and one for the rounded edges and
+  // corners.
+  const unsigned int list = piece_list_base_
+      + (CUBE_FACE_COUNT + 1) * (PIECE_LOD_COUNT * data.mesh_index + piece_lod_);
+
+  glMatrixMode(GL_TEXTURE);
+
+  for (int face = 0; face < CUBE_FACE_COUNT; ++face)
+  {
+    glLoadMatrixf(get_pose_texture_matrix(data.pose, face)[0]);
+    glCallList(list + face);
   }
+
+  glLoadIdentity();
+  glMatrixMode(GL_MODELVIEW);
+
+  glCallList(list + CUBE_FACE_COUNT);
+
+  glPopMatrix();
 }
 
 int CubeScene::gl_draw_piece_buffer_range(int first, int last) const
@@ -1657,7 +1818,31 @@ int CubeScene::gl_draw_piece_buffer_range(int first, int last) const
   if (piece_buffers_[0] && piece_buffers_[1])
   {
     gl_ext()->BindBuffer(GL_ARRAY_BUFFER_ARB, piece_buffers_[0]);
-    glInterleavedArrays(CUBE_ELEMENT_TYPE, 0, GL::buffer_offset(0));
+
+    // The packed elements are laid out by hand, as none of the formats
+    // of glInterleavedArrays() has fixed point components.
+    glVertexPointer(3, GL_SHORT, sizeof(PackedElement),
+                    GL::buffer_offset(G_STRUCT_OFFSET(PackedElement, vertex)));
+    glNormalPointer(GL_BYTE, sizeof(PackedElement),
+                    GL::buffer_offset(G_STRUCT_OFFSET(PackedElement, normal)));
+    glTexCoordPointer(2, GL_SHORT, sizeof(PackedElement),
+                      GL::buffer_offset(G_STRUCT_OFFSET(PackedElement, texcoord)));
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    // The scale of the fixed point positions would carry over to the
+    // normals.  Rescaling them is cheaper than GL_NORMALIZE, and suffices
+    // since the scale is uniform.
+    const GLenum normal_mode = (gl_ext()->have_rescale_normal) ? GL_RESCALE_NORMAL_EXT : GL_NORMALIZE;
+
+    glEnable(normal_mode);
+
+    glMatrixMode(GL_TEXTURE);
+    glPushMatrix();
+    glScalef(1.0f / PACKED_ELEMENT_UNIT, 1.0f / PACKED_ELEMENT_UNIT, 1.0f);
+    glMatrixMode(GL_MODELVIEW);
 
     gl_ext()->BindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, piece_buffers_[1]);
 
@@ -1693,6 +1878,12 @@ int CubeScene::gl_draw_piece_buffer_range(int first, int last) const
 
     gl_ext()->BindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
 
+    glMatrixMode(GL_TEXTURE);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+
+    glDisable(normal_mode);
+
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_NORMAL_ARRAY);
     glDisableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -1707,7 +1898,7 @@ int CubeScene::gl_draw_piece_list_range(int first, int last) const
 {
   int triangle_count = 0;
 
-  if (piece_list_base_ && last < piece_list_count_)
+  if (piece_list_base_)
   {
     int last_fixed = last;
 
@@ -1722,9 +1913,10 @@ int CubeScene::gl_draw_piece_list_range(int first, int last) const
 
         if (i >= first && i <= last_fixed)
         {
-          triangle_count += animation_data_[i].triangle_count;
+          const AnimationData& data = animation_data_[i];
+          triangle_count += data.triangle_count;
 
-          glCallList(piece_list_base_ + i);
+          gl_draw_piece_list(data);
         }
       }
     }
@@ -1735,7 +1927,7 @@ int CubeScene::gl_draw_piece_list_range(int first, int last) const
       triangle_count += data.triangle_count;
 
       gl_translate_animated_piece(data.direction);
-      glCallList(piece_list_base_ + last);
+      gl_draw_piece_list(data);
     }
   }
 
@@ -1845,9 +2037,19 @@ void CubeScene::gl_update_wireframe()
   }
 }
 
+/*
+ * The buffer objects hold the geometry of every shape seen so far, and are
+ * only rebuilt if a new shape turns up.  Since all solutions of a puzzle
+ * are made of the same shapes, switching between them then merely points
+ * the pieces to the right places in the buffers.  Once the buffers fill
+ * up, they start over with the shapes currently in use.
+ */
 void CubeScene::gl_update_cube_pieces()
 {
-  gl_delete_cube_pieces();
+  const bool use_buffers = gl_ext()->have_vertex_buffer_object;
+
+  if (!use_buffers)
+    gl_delete_cube_pieces();
 
   const unsigned int piece_count = cube_pieces_.size();
 
@@ -1857,10 +2059,24 @@ void CubeScene::gl_update_cube_pieces()
 
     try
     {
-      if (gl_ext()->have_vertex_buffer_object)
-        gl_create_piece_buffers();
+      if (use_buffers)
+      {
+        if (update_piece_meshes(atlas_shapes_) || piece_buffers_[0] == 0)
+        {
+          if (!atlas_meshes_.empty()
+              && atlas_meshes_.back().element_last >= ATLAS_ELEMENT_LIMIT)
+          {
+            atlas_shapes_.clear();
+            update_piece_meshes(atlas_shapes_);
+          }
+          gl_delete_cube_pieces();
+          gl_create_piece_buffers();
+        }
+      }
       else
         gl_create_piece_lists();
+
+      update_piece_ranges();
     }
     catch (...)
     {
@@ -1897,44 +2113,53 @@ void CubeScene::gl_create_piece_buffers()
 {
   g_return_if_fail(piece_buffers_[0] == 0 && piece_buffers_[1] == 0);
 
-  CubeElementArray  element_array;
-  CubeIndexArray    index_array;
+  PackedElementArray  element_array;
+  CubeIndexArray      index_array;
 
-  element_array.reserve(2048);
-  index_array.reserve(10240);
+  element_array.reserve(4096);
+  index_array.reserve(20480);
 
-  CubeTesselator tesselator;
+  // Each shape is stored once per level of detail, and is drawn transformed
+  // into the poses of its pieces.  Shapes that were in the buffers before
+  // come straight from the caches, and the new ones are tesselated
+  // concurrently before their geometry is put together here.
+  const unsigned int shape_count = atlas_shapes_.size();
 
-  tesselator.set_element_array(&element_array);
-  tesselator.set_index_array(&index_array);
-  tesselator.set_cellsize(cube_cell_size);
+  atlas_meshes_.assign(PIECE_LOD_COUNT * shape_count, PieceMesh());
 
-  for (std::vector<AnimationData>::iterator p = animation_data_.begin();
-       p != animation_data_.end(); ++p)
+  for (int lod = 0; lod < PIECE_LOD_COUNT; ++lod)
   {
-    AnimationData& data = *p;
-    g_return_if_fail(data.cube_index < cube_pieces_.size());
+    TesselationCache& cache = piece_caches_[lod];
 
-    const unsigned int offset = index_array.size();
-    const unsigned int first  = element_array.size();
+    cache.set_cellsize(cube_cell_size);
+    cache.set_edge_slices(piece_details[lod].edge_slices);
+    cache.prefetch(atlas_shapes_, tesselation_thread_count);
+  }
 
-    tesselator.run(cube_pieces_[data.cube_index]);
+  for (unsigned int i = 0; i < shape_count; ++i)
+    for (int lod = 0; lod < PIECE_LOD_COUNT; ++lod)
+    {
+      PieceMesh& mesh = atlas_meshes_[PIECE_LOD_COUNT * i + lod];
 
-    const int count = tesselator.reset_triangle_count();
-    g_return_if_fail(3 * count == int(index_array.size() - offset));
+      const unsigned int offset = index_array.size();
+      const unsigned int first  = element_array.size();
 
-    data.triangle_count = count;
-    data.indices_offset = offset;
-    data.element_first  = first;
-    data.element_last   = element_array.size() - 1;
-  }
+      const int count = piece_caches_[lod].append(atlas_shapes_[i], element_array,
+                                                  index_array, mesh.face_ends);
+      g_return_if_fail(3 * count == int(index_array.size() - offset));
+
+      mesh.triangle_count = count;
+      mesh.indices_offset = offset;
+      mesh.element_first  = first;
+      mesh.element_last   = element_array.size() - 1;
+    }
 
   gl_ext()->GenBuffers(2, piece_buffers_);
   GL::Error::throw_if_fail(piece_buffers_[0] != 0 && piece_buffers_[1] != 0);
 
   gl_ext()->BindBuffer(GL_ARRAY_BUFFER_ARB, piece_buffers_[0]);
   gl_ext()->BufferData(GL_ARRAY_BUFFER_ARB,
-                       element_array.size() * sizeof(CubeElement),
+                       element_array.size() * sizeof(PackedElement),
                        &element_array[0], GL_STATIC_DRAW_ARB);
 
   gl_ext()->BindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, piece_buffers_[1]);
@@ -1966,44 +2191,57 @@ void CubeScene::gl_create_piece_lists()
   tesselator.set_range_arrays(&start_array, &count_array);
   tesselator.set_cellsize(cube_cell_size);
 
-  const int piece_count = animation_data_.size();
+  std::vector<Cube> shapes;
+  update_piece_meshes(shapes);
 
-  piece_list_base_ = glGenLists(piece_count);
+  const int mesh_count = PIECE_LOD_COUNT * shapes.size();
+  const int list_count = (CUBE_FACE_COUNT + 1) * mesh_count;
+
+  piece_list_base_ = glGenLists(list_count);
   GL::Error::throw_if_fail(piece_list_base_ != 0);
 
-  piece_list_count_ = piece_count;
+  piece_list_count_ = list_count;
 
-  for (int i = 0; i < piece_count; ++i)
-  {
-    AnimationData& data = animation_data_[i];
-    g_return_if_fail(data.cube_index < cube_pieces_.size());
+  atlas_meshes_.assign(mesh_count, PieceMesh());
 
-    tesselator.run(cube_pieces_[data.cube_index]);
+  for (int i = 0; i < mesh_count; ++i)
+  {
+    tesselator.set_edge_slices(piece_details[i % PIECE_LOD_COUNT].edge_slices);
+    tesselator.run(shapes[i / PIECE_LOD_COUNT]);
 
     g_return_if_fail(!element_array.empty() && !start_array.empty());
     g_return_if_fail(start_array.size() == count_array.size());
 
-    data.triangle_count = tesselator.reset_triangle_count();
-    data.indices_offset = 0;
-    data.element_first  = 0;
-    data.element_last   = element_array.size() - 1;
+    PieceMesh& mesh = atlas_meshes_[i];
+
+    mesh.triangle_count = tesselator.reset_triangle_count();
+    mesh.element_last   = element_array.size() - 1;
 
     glInterleavedArrays(CUBE_ELEMENT_TYPE, 0, &element_array[0]);
+
+    int first = 0;
+
+    // The strips of the flat faces of each direction go into a list of
+    // their own, followed by the list of the rounded edges and corners.
+    for (int face = 0; face <= CUBE_FACE_COUNT; ++face)
     {
-      GL::ScopeList list (piece_list_base_ + i, GL_COMPILE);
+      const int last = (face < CUBE_FACE_COUNT) ? tesselator.get_face_end(face)
+                                                : int(start_array.size());
+      const int count = last - first;
 
-      gl_set_piece_material(data.cube_index);
-      const int count = start_array.size();
+      GL::ScopeList list (piece_list_base_ + (CUBE_FACE_COUNT + 1) * i + face, GL_COMPILE);
 
-      if (gl_ext()->have_multi_draw_arrays)
+      if (count > 0 && gl_ext()->have_multi_draw_arrays)
       {
-        gl_ext()->MultiDrawArrays(GL_TRIANGLE_STRIP, &start_array[0], &count_array[0], count);
+        gl_ext()->MultiDrawArrays(GL_TRIANGLE_STRIP, &start_array[first], &count_array[first], count);
       }
       else
       {
-        for (int k = 0; k < count; ++k)
+        for (int k = first; k < last; ++k)
           glDrawArrays(GL_TRIANGLE_STRIP, start_array[k], count_array[k]);
       }
+
+      first = last;
     }
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_NORMAL_ARRAY);
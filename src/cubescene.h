@@ -22,13 +22,16 @@
 #define SOMATO_CUBESCENE_H_INCLUDED
 
 #include "glscene.h"
+#include "assembly.h"
 #include "cube.h"
 #include "puzzle.h"
+#include "tesselate.h"
 #include "vectormath.h"
 
 #include <sigc++/sigc++.h>
 #include <glibmm/timer.h>
 #include <glibmm/ustring.h>
+#include <algorithm>
 #include <vector>
 
 #include <config.h>
@@ -36,13 +39,19 @@
 namespace Somato
 {
 
+// Number of levels of detail at which the piece geometry is kept.
+enum { PIECE_LOD_COUNT = 3 };
+
 struct AnimationData
 {
   int           triangle_count; // number of triangles generated by the tesselator
   unsigned int  indices_offset; // VBO only: offset into element indices array
   unsigned int  element_first;  // VBO only: minimum referenced element index
   unsigned int  element_last;   // VBO only: maximum referenced element index
+  unsigned int  face_ends[CUBE_FACE_COUNT]; // VBO only: index counts per face direction
   unsigned int  cube_index;     // index into pieces vector in original order
+  unsigned int  mesh_index;     // index of the geometry shared by its shape
+  PiecePose     pose;           // transformation from the canonical pose
   float         direction[3];   // direction of cube animation movement
 
   inline AnimationData();
@@ -52,6 +61,22 @@ struct AnimationData
   int get_vertex_count() const { return element_last - element_first + 1; }
 };
 
+/*
+ * Range of the geometry of a shape at one level of detail.  The meshes
+ * of a shape are stored at consecutive indices, finest level first.
+ */
+struct PieceMesh
+{
+  int           triangle_count; // number of triangles generated by the tesselator
+  unsigned int  indices_offset; // offset into element indices array
+  unsigned int  element_first;  // minimum referenced element index
+  unsigned int  element_last;   // maximum referenced element index
+  unsigned int  face_ends[CUBE_FACE_COUNT]; // index counts per face direction
+
+  PieceMesh() : triangle_count (0), indices_offset (0), element_first (0), element_last (0)
+    { std::fill(face_ends, face_ends + CUBE_FACE_COUNT, 0u); }
+};
+
 struct PieceCell
 {
   unsigned int piece;   // animation index of cube piece
@@ -148,6 +173,8 @@ private:
   Math::Quat                  rotation_;
 
   std::vector<Cube>           cube_pieces_;
+  AssemblyPlanner             assembly_planner_;
+  TesselationCache            piece_caches_[PIECE_LOD_COUNT];
   std::vector<AnimationData>  animation_data_;
   PieceCellVector             piece_cells_;
   std::vector<int>            depth_order_;
@@ -163,10 +190,13 @@ private:
 
   unsigned int                cube_texture_;
   unsigned int                piece_buffers_[2];
+  std::vector<Cube>           atlas_shapes_;  // shapes held by the piece buffers
+  std::vector<PieceMesh>      atlas_meshes_;  // of the buffers or the lists
   unsigned int                wireframe_buffers_[2];
   unsigned int                wireframe_list_;
   unsigned int                piece_list_base_;
   int                         piece_list_count_;
+  int                         piece_lod_;     // level of detail in use
 
   int                         track_last_x_;
   int                         track_last_y_;
@@ -192,6 +222,8 @@ private:
   void update_animation_order();
   void update_depth_order();
   void update_animation_timer();
+  bool update_piece_meshes(std::vector<Cube>& shapes);
+  void update_piece_ranges();
 
   void start_piece_animation();
   void pause_animation();
@@ -218,7 +250,10 @@ private:
 
   inline void gl_translate_animated_piece(const float* direction) const;
 
+  void gl_draw_piece_triangles(const AnimationData& data, unsigned int first,
+                               unsigned int count, const Math::Matrix4& texmatrix) const;
   void gl_draw_piece_elements(const AnimationData& data) const;
+  void gl_draw_piece_list(const AnimationData& data) const;
   int  gl_draw_piece_buffer_range(int first, int last) const;
   int  gl_draw_piece_list_range(int first, int last) const;
 
@@ -238,8 +273,16 @@ AnimationData::AnimationData()
   indices_offset  (0),
   element_first   (0),
   element_last    (0),
-  cube_index      (0)
+  cube_index      (0),
+  mesh_index      (0)
 {
+  std::fill(face_ends, face_ends + CUBE_FACE_COUNT, 0u);
+
+  pose.rotation  = 0;
+  pose.offset[0] = 0;
+  pose.offset[1] = 0;
+  pose.offset[2] = 0;
+
   direction[0] = 0.0;
   direction[1] = 0.0;
   direction[2] = 0.0;
@@ -252,8 +295,12 @@ AnimationData::AnimationData(const AnimationData& b)
   indices_offset (b.indices_offset),
   element_first  (b.element_first),
   element_last   (b.element_last),
-  cube_index     (b.cube_index)
+  cube_index     (b.cube_index),
+  mesh_index     (b.mesh_index),
+  pose           (b.pose)
 {
+  std::copy(b.face_ends, b.face_ends + CUBE_FACE_COUNT, face_ends);
+
   direction[0] = b.direction[0];
   direction[1] = b.direction[1];
   direction[2] = b.direction[2];
@@ -267,6 +314,10 @@ AnimationData& AnimationData::operator=(const AnimationData& b)
   element_first  = b.element_first;
   element_last   = b.element_last;
   cube_index     = b.cube_index;
+  mesh_index     = b.mesh_index;
+  pose           = b.pose;
+
+  std::copy(b.face_ends, b.face_ends + CUBE_FACE_COUNT, face_ends);
 
   direction[0] = b.direction[0];
   direction[1] = b.direction[1];
@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "diagram.h"
+
+#include <algorithm>
+
+#include <config.h>
+
+namespace
+{
+
+/*
+ * Draw an integer below the bound from the random generator.  Values in
+ * the incomplete last interval of the 64-bit range are rejected, since a
+ * plain modulo would favor the low indices.
+ */
+static
+guint64 random_below(GRand* rand, guint64 bound)
+{
+  const guint64 limit = G_MAXUINT64 - G_MAXUINT64 % bound;
+  guint64 value;
+
+  do
+    value = (guint64(g_rand_int(rand)) << 32) | g_rand_int(rand);
+  while (value >= limit);
+
+  return value % bound;
+}
+
+} // anonymous namespace
+
+namespace Somato
+{
+
+/*
+ * The unique table stores node ids, which are hashed and compared by the
+ * content of the node they refer to.
+ */
+class SolutionDiagram::NodeHash
+{
+private:
+  const std::vector<Node>& nodes_;
+
+public:
+  explicit NodeHash(const std::vector<Node>& nodes) : nodes_ (nodes) {}
+
+  unsigned int operator()(const Node& node) const;
+  unsigned int operator()(guint32 id) const { return (*this)(nodes_[id]); }
+};
+
+class SolutionDiagram::NodeEqual
+{
+private:
+  const std::vector<Node>& nodes_;
+
+public:
+  explicit NodeEqual(const std::vector<Node>& nodes) : nodes_ (nodes) {}
+
+  bool operator()(guint32 id, const Node& node) const
+  {
+    const Node& other = nodes_[id];
+    return (other.var == node.var && other.lo == node.lo && other.hi == node.hi);
+  }
+};
+
+unsigned int SolutionDiagram::NodeHash::operator()(const Node& node) const
+{
+  unsigned int h = node.var * 2654435769U;
+  h ^= (h >> 16) + node.lo * 2246822519U;
+  h ^= (h >> 13) + node.hi * 3266489917U;
+
+  return h ^ (h >> 16);
+}
+
+SolutionDiagram::Iterator::Iterator(const SolutionDiagram& diagram)
+:
+  diagram_  (diagram),
+  path_     (),
+  started_  (false)
+{}
+
+SolutionDiagram::Iterator::~Iterator()
+{}
+
+/*
+ * The path holds the nodes whose placements are part of the current
+ * solution.  To advance, the deepest of them which has an alternative is
+ * replaced by its low branch, and the high branches are followed from
+ * there on.  High branches are never empty, so this always ends up at
+ * the next solution.
+ */
+bool SolutionDiagram::Iterator::next(Cube* pieces)
+{
+  const std::vector<Node>& nodes = diagram_.nodes_;
+  guint32 node = FALSE_NODE;
+
+  if (!started_)
+  {
+    started_ = true;
+    node = diagram_.root_;
+  }
+  else
+    while (node == FALSE_NODE && !path_.empty())
+    {
+      node = nodes[path_.back()].lo;
+      path_.pop_back();
+    }
+
+  if (node == FALSE_NODE)
+    return false;
+
+  for (; node != TRUE_NODE; node = nodes[node].hi)
+    path_.push_back(node);
+
+  for (std::vector<guint32>::const_iterator p = path_.begin(); p != path_.end(); ++p)
+  {
+    const guint32 var = nodes[*p].var;
+    pieces[var_piece(var)] = var_placement(var);
+  }
+
+  return true;
+}
+
+SolutionDiagram::SolutionDiagram()
+:
+  nodes_        (),
+  counts_       (),
+  unique_       (1),
+  root_         (FALSE_NODE),
+  piece_count_  (0)
+{
+  begin(0);
+  end(FALSE_NODE);
+}
+
+SolutionDiagram::~SolutionDiagram()
+{}
+
+void SolutionDiagram::swap(SolutionDiagram& other)
+{
+  nodes_.swap(other.nodes_);
+  counts_.swap(other.counts_);
+  unique_.swap(other.unique_);
+  std::swap(root_, other.root_);
+  std::swap(piece_count_, other.piece_count_);
+}
+
+void SolutionDiagram::clear()
+{
+  SolutionDiagram empty;
+  swap(empty);
+}
+
+/*
+ * Descend to the solution at the given index, skipping over the whole
+ * high branch of a node whenever the index lies beyond it.
+ */
+void SolutionDiagram::at(guint64 index, Cube* pieces) const
+{
+  g_return_if_fail(index < size());
+
+  for (guint32 node = root_; node != TRUE_NODE;)
+  {
+    const Node&   n     = nodes_[node];
+    const guint64 count = counts_[n.hi];
+
+    if (index < count)
+    {
+      pieces[var_piece(n.var)] = var_placement(n.var);
+      node = n.hi;
+    }
+    else
+    {
+      index -= count;
+      node = n.lo;
+    }
+  }
+}
+
+/*
+ * Compute the index of a solution, which is the inverse of at().  The
+ * placements of a piece are chained in ascending order along the low
+ * branches, thus the lookup can give up as soon as it has passed the
+ * placement sought.  Returns -1 if the solution is not in the diagram.
+ */
+gint64 SolutionDiagram::index_of(const Cube* pieces) const
+{
+  guint64 index = 0;
+  guint32 node  = root_;
+
+  while (node >= TERMINAL_COUNT)
+  {
+    const Node&      n    = nodes_[node];
+    const Cube::Bits have = var_placement(n.var).to_bits();
+    const Cube::Bits want = pieces[var_piece(n.var)].to_bits();
+
+    if (want == have)
+    {
+      node = n.hi;
+    }
+    else if (want > have)
+    {
+      index += counts_[n.hi];
+      node = n.lo;
+    }
+    else
+      return -1;
+  }
+
+  return (node == TRUE_NODE) ? gint64(index) : -1;
+}
+
+void SolutionDiagram::sample(GRand* rand, Cube* pieces) const
+{
+  g_return_if_fail(rand != 0);
+  g_return_if_fail(!empty());
+
+  at(random_below(rand, size()), pieces);
+}
+
+void SolutionDiagram::begin(int n_pieces)
+{
+  g_return_if_fail(n_pieces >= 0 && n_pieces < (1 << (32 - PIECE_SHIFT)));
+
+  nodes_.resize(TERMINAL_COUNT);
+  counts_.resize(TERMINAL_COUNT);
+
+  for (int i = 0; i < TERMINAL_COUNT; ++i)
+  {
+    nodes_[i].var = G_MAXUINT32;
+    nodes_[i].lo  = i;
+    nodes_[i].hi  = i;
+    counts_[i]    = i;
+  }
+
+  Util::ProbeTable<guint32>(1024).swap(unique_);
+  root_        = FALSE_NODE;
+  piece_count_ = n_pieces;
+}
+
+/*
+ * Return the node for the given variable and branches.  A node without
+ * solutions in its high branch is left out, as per the zero-suppression
+ * rule, and nodes are shared with any existing node of the same content.
+ */
+guint32 SolutionDiagram::make_node(int piece, Cube placement, guint32 lo, guint32 hi)
+{
+  if (hi == FALSE_NODE)
+    return lo;
+
+  Node node;
+
+  node.var = (guint32(piece) << PIECE_SHIFT) | placement.to_bits();
+  node.lo  = lo;
+  node.hi  = hi;
+
+  const NodeHash     hash (nodes_);
+  const unsigned int slot = unique_.find_slot(node, hash, NodeEqual(nodes_));
+
+  if (unique_[slot] != 0)
+    return unique_[slot];
+
+  const guint32 id = nodes_.size();
+
+  nodes_.push_back(node);
+  counts_.push_back(counts_[lo] + counts_[hi]);
+  unique_.insert(slot, id, node, hash);
+
+  return id;
+}
+
+/*
+ * Finish construction.  The hash table is not needed for any of the
+ * queries, and the node storage is trimmed to its actual size.
+ */
+void SolutionDiagram::end(guint32 root)
+{
+  Util::ProbeTable<guint32>(1).swap(unique_);
+  std::vector<Node>(nodes_).swap(nodes_);
+  std::vector<guint64>(counts_).swap(counts_);
+
+  root_ = root;
+}
+
+} // namespace Somato
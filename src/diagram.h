@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOMATO_DIAGRAM_H_INCLUDED
+#define SOMATO_DIAGRAM_H_INCLUDED
+
+#include "array.h"
+#include "cube.h"
+
+#include <glib.h>
+#include <vector>
+
+#include <config.h>
+
+namespace Somato
+{
+
+/*
+ * The solutions of a puzzle as a zero-suppressed decision diagram, built
+ * by PuzzleSolver::build_diagram().  Each variable stands for a placement
+ * of one of the pieces, and each path to the true terminal for a solution.
+ * Equal subdiagrams are stored only once, thus the memory used depends on
+ * the size of the diagram rather than on the number of solutions.
+ *
+ * Solutions are passed as arrays of placements, one for each piece in the
+ * order the pieces were added to the solver.  Indices refer to the order
+ * in which solve() would report the solutions without propagation.
+ */
+class SolutionDiagram
+{
+  friend class PuzzleSolver;
+
+public:
+  class Iterator
+  {
+  public:
+    explicit Iterator(const SolutionDiagram& diagram);
+    ~Iterator();
+
+    // Store the next solution and return true, or return false once
+    // all solutions have been visited.
+    bool next(Cube* pieces);
+
+  private:
+    const SolutionDiagram&  diagram_;
+    std::vector<guint32>    path_;
+    bool                    started_;
+
+    // noncopyable
+    Iterator(const Iterator&);
+    Iterator& operator=(const Iterator&);
+  };
+
+  SolutionDiagram();
+  ~SolutionDiagram();
+
+  void swap(SolutionDiagram& other);
+  void clear();
+
+  guint64 size()  const { return counts_[root_]; }
+  bool    empty() const { return (root_ == FALSE_NODE); }
+
+  int get_piece_count() const { return piece_count_; }
+  int get_node_count()  const { return nodes_.size() - TERMINAL_COUNT; }
+
+  void   at(guint64 index, Cube* pieces) const;
+  gint64 index_of(const Cube* pieces) const;
+  bool   contains(const Cube* pieces) const { return (index_of(pieces) >= 0); }
+
+  // Pick a solution at random, with equal probability for each.
+  void sample(GRand* rand, Cube* pieces) const;
+
+private:
+  // The variable holds the piece index above the placement bits, so that
+  // variables are ordered by piece first and by placement second.
+  enum { PIECE_SHIFT = 27 };
+  enum { FALSE_NODE = 0, TRUE_NODE = 1, TERMINAL_COUNT = 2 };
+
+  struct Node
+  {
+    guint32 var;
+    guint32 lo;   // solutions without the placement
+    guint32 hi;   // solutions with the placement, minus the placement
+  };
+
+  class NodeHash;
+  class NodeEqual;
+
+  std::vector<Node>          nodes_;
+  std::vector<guint64>       counts_;  // number of solutions below each node
+  Util::ProbeTable<guint32>  unique_;  // node ids, only kept while building
+  guint32                    root_;
+  int                        piece_count_;
+
+  // noncopyable
+  SolutionDiagram(const SolutionDiagram&);
+  SolutionDiagram& operator=(const SolutionDiagram&);
+
+  static int  var_piece(guint32 var) { return var >> PIECE_SHIFT; }
+  static Cube var_placement(guint32 var) { return Cube::from_bits(var); }
+
+  void    begin(int n_pieces);
+  guint32 make_node(int piece, Cube placement, guint32 lo, guint32 hi);
+  void    end(guint32 root);
+};
+
+} // namespace Somato
+
+#endif /* SOMATO_DIAGRAM_H_INCLUDED */
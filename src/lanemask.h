@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef SOMATO_LANEMASK_H_INCLUDED
+#define SOMATO_LANEMASK_H_INCLUDED
+
+#include <config.h>
+
+#if SOMATO_VECTOR_USE_SSE2
+# include <emmintrin.h>
+#endif
+
+namespace Somato
+{
+
+/*
+ * Somato::LaneMask holds one 32-bit cell mask or counter for each of four
+ * independent searches, in the lanes of an SSE2 register if available.
+ * Comparisons yield all ones in the lanes where they hold, and zero in all
+ * others, so that their results may be used as masks for further steps.
+ */
+class LaneMask
+{
+public:
+  enum { WIDTH = 4 };
+
+  typedef unsigned int value_type;
+
+  inline LaneMask();
+  explicit inline LaneMask(value_type b); // broadcast to all lanes
+
+  static inline LaneMask load(const value_type* b);
+  inline void store(value_type* b) const;
+
+  inline LaneMask& operator&=(const LaneMask& b);
+  inline LaneMask& operator|=(const LaneMask& b);
+  inline LaneMask& operator-=(const LaneMask& b);
+
+  // All ones in the lanes where (a & b) is zero.
+  static inline LaneMask disjoint(const LaneMask& a, const LaneMask& b);
+
+  // Whether any lane is non-zero.
+  inline bool any() const;
+
+private:
+#if SOMATO_VECTOR_USE_SSE2
+  __m128i v_;
+
+  explicit inline LaneMask(__m128i v) : v_ (v) {}
+#else
+  value_type v_[WIDTH];
+#endif
+};
+
+inline
+LaneMask operator&(LaneMask a, const LaneMask& b)
+{
+  return (a &= b);
+}
+
+inline
+LaneMask operator|(LaneMask a, const LaneMask& b)
+{
+  return (a |= b);
+}
+
+#if SOMATO_VECTOR_USE_SSE2
+
+inline
+LaneMask::LaneMask()
+:
+  v_ (_mm_setzero_si128())
+{}
+
+inline
+LaneMask::LaneMask(LaneMask::value_type b)
+:
+  v_ (_mm_set1_epi32(b))
+{}
+
+// static
+inline
+LaneMask LaneMask::load(const LaneMask::value_type* b)
+{
+  return LaneMask(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)));
+}
+
+inline
+void LaneMask::store(LaneMask::value_type* b) const
+{
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(b), v_);
+}
+
+inline
+LaneMask& LaneMask::operator&=(const LaneMask& b)
+{
+  v_ = _mm_and_si128(v_, b.v_);
+  return *this;
+}
+
+inline
+LaneMask& LaneMask::operator|=(const LaneMask& b)
+{
+  v_ = _mm_or_si128(v_, b.v_);
+  return *this;
+}
+
+inline
+LaneMask& LaneMask::operator-=(const LaneMask& b)
+{
+  v_ = _mm_sub_epi32(v_, b.v_);
+  return *this;
+}
+
+// static
+inline
+LaneMask LaneMask::disjoint(const LaneMask& a, const LaneMask& b)
+{
+  return LaneMask(_mm_cmpeq_epi32(_mm_and_si128(a.v_, b.v_), _mm_setzero_si128()));
+}
+
+inline
+bool LaneMask::any() const
+{
+  return (_mm_movemask_epi8(_mm_cmpeq_epi32(v_, _mm_setzero_si128())) != 0xFFFF);
+}
+
+#else /* !SOMATO_VECTOR_USE_SSE2 */
+
+inline
+LaneMask::LaneMask()
+{
+  for (int i = 0; i < WIDTH; ++i)
+    v_[i] = 0;
+}
+
+inline
+LaneMask::LaneMask(LaneMask::value_type b)
+{
+  for (int i = 0; i < WIDTH; ++i)
+    v_[i] = b;
+}
+
+// static
+inline
+LaneMask LaneMask::load(const LaneMask::value_type* b)
+{
+  LaneMask result;
+
+  for (int i = 0; i < WIDTH; ++i)
+    result.v_[i] = b[i];
+
+  return result;
+}
+
+inline
+void LaneMask::store(LaneMask::value_type* b) const
+{
+  for (int i = 0; i < WIDTH; ++i)
+    b[i] = v_[i];
+}
+
+inline
+LaneMask& LaneMask::operator&=(const LaneMask& b)
+{
+  for (int i = 0; i < WIDTH; ++i)
+    v_[i] &= b.v_[i];
+
+  return *this;
+}
+
+inline
+LaneMask& LaneMask::operator|=(const LaneMask& b)
+{
+  for (int i = 0; i < WIDTH; ++i)
+    v_[i] |= b.v_[i];
+
+  return *this;
+}
+
+inline
+LaneMask& LaneMask::operator-=(const LaneMask& b)
+{
+  for (int i = 0; i < WIDTH; ++i)
+    v_[i] -= b.v_[i];
+
+  return *this;
+}
+
+// static
+inline
+LaneMask LaneMask::disjoint(const LaneMask& a, const LaneMask& b)
+{
+  LaneMask result;
+
+  for (int i = 0; i < WIDTH; ++i)
+    result.v_[i] = ((a.v_[i] & b.v_[i]) == 0) ? ~value_type(0) : value_type(0);
+
+  return result;
+}
+
+inline
+bool LaneMask::any() const
+{
+  return ((v_[0] | v_[1] | v_[2] | v_[3]) != 0);
+}
+
+#endif /* !SOMATO_VECTOR_USE_SSE2 */
+
+} // namespace Somato
+
+#endif /* SOMATO_LANEMASK_H_INCLUDED */
@@ -56,6 +56,14 @@
 namespace
 {
 
+/*
+ * The number of solutions to look for before the first one is displayed,
+ * and the time budget for doing so in seconds.  The complete solution
+ * index is built only once the user navigates past these.
+ */
+static const int    first_solution_limit = 8;
+static const double first_solution_time_limit = 0.05;
+
 static const char *const program_license =
   "Somato is free software; you can redistribute it and/or modify it "
   "under the terms of the GNU General Public License as published by "
@@ -183,12 +191,15 @@ MainWindow::MainWindow()
   scale_zoom_       (0),
   statusbar_        (0),
   aboutdialog_      (),
+  first_solutions_  (),
   solutions_        (),
   puzzle_thread_    (),
   profile_timer_    (),
   conn_cycle_       (),
   conn_profile_     (),
   cube_index_       (-1),
+  pending_index_    (-1),
+  exhaustive_       (false),
   context_cube_     (0),
   context_profile_  (0)
 {
@@ -208,10 +219,21 @@ Gtk::Window* MainWindow::get_window()
   return window_.get();
 }
 
+/*
+ * Start out by searching for the first few solutions only, so that the
+ * animation can begin right away.
+ */
 void MainWindow::run_puzzle_solver()
+{
+  start_puzzle_thread(first_solution_limit, first_solution_time_limit);
+}
+
+void MainWindow::start_puzzle_thread(int solution_limit, double time_limit)
 {
   std::auto_ptr<PuzzleThread> thread (new PuzzleThread());
 
+  thread->set_solution_limit(solution_limit);
+  thread->set_time_limit(time_limit);
   thread->signal_done().connect(sigc::mem_fun(*this, &MainWindow::on_puzzle_thread_done));
   thread->run();
 
@@ -359,29 +381,47 @@ void MainWindow::init_cube_scene()
   cube_scene_->grab_focus();
 }
 
-bool MainWindow::start_animation()
+/*
+ * Build the complete solution index in the background, unless it is
+ * already in progress.
+ */
+void MainWindow::index_all_solutions()
 {
-  {
-    // Now we may safely delete the puzzle thread object.
-    const std::auto_ptr<PuzzleThread> thread (puzzle_thread_);
-  }
+  if (!puzzle_thread_.get())
+    start_puzzle_thread(0, 0.0);
+}
 
-  switch_cube(0);
-  actions_->animation_pause->set_active(false);
+int MainWindow::get_solution_count() const
+{
+  return (solutions_.empty()) ? int(first_solutions_.size()) : solutions_.size();
+}
 
-  return false; // disconnect
+Solution MainWindow::get_solution(int index) const
+{
+  return (solutions_.empty()) ? first_solutions_[index] : solutions_.at(index);
 }
 
 void MainWindow::switch_cube(int index)
 {
-  const int max_index = int(solutions_.size()) - 1;
+  const int count = get_solution_count();
+
+  if (index >= count && !exhaustive_)
+  {
+    // Stay with what we have for now, and move on to the requested
+    // solution as soon as the complete index is available.
+    pending_index_ = index;
+    index_all_solutions();
+  }
+
+  const int max_index = count - 1;
+  const bool more     = (count > 0 && !exhaustive_);
 
   cube_index_ = Math::min(Math::max(0, index), max_index);
 
   actions_->cube_goto_first->set_sensitive(cube_index_ > 0);
   actions_->cube_go_back   ->set_sensitive(cube_index_ > 0);
-  actions_->cube_go_forward->set_sensitive(cube_index_ < max_index);
-  actions_->cube_goto_last ->set_sensitive(cube_index_ < max_index);
+  actions_->cube_go_forward->set_sensitive(cube_index_ < max_index || more);
+  actions_->cube_goto_last ->set_sensitive(cube_index_ < max_index || more);
   actions_->animation_play ->set_sensitive(cube_index_ >= 0);
   actions_->animation_pause->set_sensitive(cube_index_ >= 0);
 
@@ -389,7 +429,7 @@ void MainWindow::switch_cube(int index)
   {
 #if SOMATO_HAVE_USTRING__COMPOSE
     cube_scene_->set_heading(Glib::ustring::compose("Soma cube #%1", cube_index_ + 1));
-    cube_scene_->set_cube_pieces(solutions_[cube_index_]);
+    cube_scene_->set_cube_pieces(get_solution(cube_index_));
 
     statusbar_->pop(context_cube_);
     statusbar_->push(Glib::ustring::compose("%1 triangles, %2 vertices",
@@ -402,7 +442,7 @@ void MainWindow::switch_cube(int index)
     output << "Soma cube #" << cube_index_ + 1;
 
     cube_scene_->set_heading(Glib::locale_to_utf8(output.str()));
-    cube_scene_->set_cube_pieces(solutions_[cube_index_]);
+    cube_scene_->set_cube_pieces(get_solution(cube_index_));
 
     output.str(std::string());
 
@@ -417,10 +457,43 @@ void MainWindow::switch_cube(int index)
 
 void MainWindow::on_puzzle_thread_done()
 {
+  // Once the complete index is available, it supersedes the first
+  // solutions found previously.
   puzzle_thread_->swap_result(solutions_);
+  puzzle_thread_->swap_first_solutions(first_solutions_);
+
+  exhaustive_ = puzzle_thread_->is_exhaustive();
+
+  Glib::signal_idle().connect(sigc::mem_fun(*this, &MainWindow::on_puzzle_thread_idle));
+}
 
-  if (!solutions_.empty())
-    Glib::signal_idle().connect(sigc::mem_fun(*this, &MainWindow::start_animation));
+bool MainWindow::on_puzzle_thread_idle()
+{
+  {
+    // Now we may safely delete the puzzle thread object.
+    const std::auto_ptr<PuzzleThread> thread (puzzle_thread_);
+  }
+
+  if (get_solution_count() == 0)
+  {
+    // Nothing found within the time budget; try again without limits.
+    if (!exhaustive_)
+      index_all_solutions();
+  }
+  else if (cube_index_ < 0)
+  {
+    switch_cube(0);
+    actions_->animation_pause->set_active(false);
+  }
+  else if (pending_index_ >= 0)
+  {
+    const int index = pending_index_;
+
+    pending_index_ = -1;
+    switch_cube(index);
+  }
+
+  return false; // disconnect
 }
 
 void MainWindow::on_speed_value_changed()
@@ -695,10 +768,10 @@ bool MainWindow::on_scene_button_press_event(GdkEventButton* event)
 
 void MainWindow::on_scene_cycle_finished()
 {
-  const int count = solutions_.size();
+  const int count = get_solution_count();
   const int next  = cube_index_ + 1;
 
-  switch_cube((next < count) ? next : 0);
+  switch_cube((next < count || !exhaustive_) ? next : 0);
 }
 
 } // namespace Somato
@@ -76,12 +76,15 @@ private:
 
   std::auto_ptr<Gtk::Window>    aboutdialog_;
 
-  std::vector<Solution>         solutions_;
+  std::vector<Solution>         first_solutions_;
+  SolutionSet                   solutions_;
   std::auto_ptr<PuzzleThread>   puzzle_thread_;
   Glib::Timer                   profile_timer_;
   sigc::connection              conn_cycle_;
   sigc::connection              conn_profile_;
   int                           cube_index_;
+  int                           pending_index_;
+  bool                          exhaustive_;
 
   unsigned int                  context_cube_;
   unsigned int                  context_profile_;
@@ -90,10 +93,14 @@ private:
 
   void load_ui();
   void init_cube_scene();
-  bool start_animation();
+  void start_puzzle_thread(int solution_limit, double time_limit);
+  void index_all_solutions();
+  int  get_solution_count() const;
+  Solution get_solution(int index) const;
   void switch_cube(int index);
 
   void on_puzzle_thread_done();
+  bool on_puzzle_thread_idle();
   void on_speed_value_changed();
   void on_zoom_value_changed();
 
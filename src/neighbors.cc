@@ -0,0 +1,389 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "neighbors.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <config.h>
+
+namespace
+{
+
+using Somato::Cube;
+
+enum { GRAPH_MAGIC = 0x534E4231 }; // "SNB1"
+enum { HEADER_SIZE = 4 };           // magic, vertex count, edge count, pad
+
+/*
+ * A solution with the placements of two of its pieces dropped.  Two
+ * solutions are neighbors exactly if they have a key in common.  The
+ * hash covers the remaining placements and decides the partition.
+ */
+struct JoinKey
+{
+  guint64 hash;
+  guint32 solution;
+  guint32 pair;
+
+  bool operator<(const JoinKey& b) const
+    { return (hash < b.hash || (hash == b.hash && pair < b.pair)); }
+};
+
+typedef std::vector<JoinKey>                          KeyStore;
+typedef std::vector<std::pair<guint32, guint32> >     EdgeStore;
+
+struct JoinContext
+{
+  const Cube*                           solutions;
+  int                                   n_solutions;
+  int                                   n_pieces;
+  int                                   n_chunks;
+  int                                   n_parts;
+  std::vector<std::pair<int, int> >     pairs;
+  std::vector<KeyStore>                 buckets;  // n_chunks * n_parts
+  std::vector<EdgeStore>                edges;    // per partition
+};
+
+static inline
+guint64 mix_placement(int piece, Cube placement)
+{
+  guint64 h = (guint64(piece) << 32 | placement.to_bits()) * G_GUINT64_CONSTANT(0x9E3779B97F4A7C15);
+
+  h ^= h >> 29;
+  h *= G_GUINT64_CONSTANT(0xBF58476D1CE4E5B9);
+  h ^= h >> 32;
+
+  return h;
+}
+
+/*
+ * Phase one: emit the keys of a range of solutions into the buckets of
+ * the chunk.  The hashes of the placements are summed up, so that the
+ * hash of each key is obtained by subtracting the two dropped ones.
+ */
+static
+void emit_keys(void* data, void* user_data)
+{
+  JoinContext& context = *static_cast<JoinContext*>(user_data);
+  const int    chunk   = GPOINTER_TO_INT(data) - 1;
+  const int    n       = context.n_pieces;
+  const int    begin   = gint64(context.n_solutions) * chunk / context.n_chunks;
+  const int    end     = gint64(context.n_solutions) * (chunk + 1) / context.n_chunks;
+
+  KeyStore *const buckets = &context.buckets[chunk * context.n_parts];
+  std::vector<guint64> mixed (n);
+
+  for (int s = begin; s < end; ++s)
+  {
+    const Cube *const solution = context.solutions + gint64(s) * n;
+    guint64 sum = 0;
+
+    for (int i = 0; i < n; ++i)
+      sum += (mixed[i] = mix_placement(i, solution[i]));
+
+    for (unsigned int p = 0; p < context.pairs.size(); ++p)
+    {
+      JoinKey key;
+
+      key.hash     = sum - mixed[context.pairs[p].first] - mixed[context.pairs[p].second];
+      key.solution = s;
+      key.pair     = p;
+
+      buckets[key.hash % context.n_parts].push_back(key);
+    }
+  }
+}
+
+static
+bool same_remainder(const JoinContext& context, const JoinKey& a, const JoinKey& b)
+{
+  const int n     = context.n_pieces;
+  const int first = context.pairs[a.pair].first;
+  const int last  = context.pairs[a.pair].second;
+
+  const Cube *const sa = context.solutions + gint64(a.solution) * n;
+  const Cube *const sb = context.solutions + gint64(b.solution) * n;
+
+  for (int i = 0; i < n; ++i)
+    if (i != first && i != last && sa[i] != sb[i])
+      return false;
+
+  return true;
+}
+
+/*
+ * Phase two: gather the keys of a partition from all chunks, sort them
+ * and connect the solutions within each run of equal keys.  The runs are
+ * short, as only few ways exist to fill the cells left by two pieces.
+ */
+static
+void join_partition(void* data, void* user_data)
+{
+  JoinContext& context = *static_cast<JoinContext*>(user_data);
+  const int    part    = GPOINTER_TO_INT(data) - 1;
+
+  KeyStore keys;
+
+  for (int chunk = 0; chunk < context.n_chunks; ++chunk)
+  {
+    KeyStore& bucket = context.buckets[chunk * context.n_parts + part];
+
+    keys.insert(keys.end(), bucket.begin(), bucket.end());
+    KeyStore().swap(bucket);
+  }
+
+  std::sort(keys.begin(), keys.end());
+
+  EdgeStore& edges = context.edges[part];
+
+  for (KeyStore::const_iterator run = keys.begin(); run != keys.end();)
+  {
+    KeyStore::const_iterator run_end = run + 1;
+
+    while (run_end != keys.end() && run_end->hash == run->hash && run_end->pair == run->pair)
+      ++run_end;
+
+    for (KeyStore::const_iterator a = run; a != run_end; ++a)
+      for (KeyStore::const_iterator b = a + 1; b != run_end; ++b)
+        if (same_remainder(context, *a, *b))
+        {
+          edges.push_back(std::make_pair(a->solution, b->solution));
+          edges.push_back(std::make_pair(b->solution, a->solution));
+        }
+
+    run = run_end;
+  }
+}
+
+static
+void run_parallel(GFunc func, JoinContext& context, int n_tasks, int n_threads)
+{
+  GThreadPool* pool = 0;
+
+  if (n_threads > 1 && g_thread_supported())
+    pool = g_thread_pool_new(func, &context, n_threads, FALSE, 0);
+
+  for (int i = 0; i < n_tasks; ++i)
+  {
+    if (pool)
+      g_thread_pool_push(pool, GINT_TO_POINTER(i + 1), 0);
+    else
+      (*func)(GINT_TO_POINTER(i + 1), &context);
+  }
+
+  if (pool)
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
+
+/*
+ * Check that the adjacency lists stay within the file, i.e. that the
+ * offsets never decrease nor exceed the target count, and that every
+ * target is a vertex of the graph.
+ */
+static
+bool check_adjacency(const guint32* offsets, guint32 n_vertices, guint32 n_targets)
+{
+  const guint32 *const targets = offsets + n_vertices + 1;
+
+  for (guint32 i = 0; i < n_vertices; ++i)
+    if (offsets[i] > offsets[i + 1] || offsets[i + 1] > n_targets)
+      return false;
+
+  for (guint32 i = 0; i < n_targets; ++i)
+    if (targets[i] >= n_vertices)
+      return false;
+
+  return true;
+}
+
+} // anonymous namespace
+
+namespace Somato
+{
+
+NeighborGraph::NeighborGraph()
+:
+  file_         (0),
+  offsets_      (0),
+  targets_      (0),
+  vertex_count_ (0)
+{}
+
+NeighborGraph::~NeighborGraph()
+{
+  clear();
+}
+
+void NeighborGraph::clear()
+{
+  if (file_)
+    g_mapped_file_free(file_);
+
+  file_         = 0;
+  offsets_      = 0;
+  targets_      = 0;
+  vertex_count_ = 0;
+}
+
+int NeighborGraph::get_edge_count() const
+{
+  return (offsets_) ? offsets_[vertex_count_] / 2 : 0;
+}
+
+int NeighborGraph::get_degree(int vertex) const
+{
+  g_return_val_if_fail(vertex >= 0 && vertex < vertex_count_, 0);
+
+  return offsets_[vertex + 1] - offsets_[vertex];
+}
+
+const guint32* NeighborGraph::get_neighbors(int vertex) const
+{
+  g_return_val_if_fail(vertex >= 0 && vertex < vertex_count_, 0);
+
+  return targets_ + offsets_[vertex];
+}
+
+/*
+ * Build the graph by a partitioned hash join of the solutions with
+ * themselves, on keys made of all placements but two.  Each thread
+ * first emits the keys of a share of the solutions, then joins a share
+ * of the partitions.  The time taken is thus linear in the number of
+ * keys, apart from sorting within the partitions.
+ */
+bool NeighborGraph::build(const Cube* solutions, int n_solutions, int n_pieces,
+                          const std::string& filename, int n_threads, std::string& error)
+{
+  g_return_val_if_fail(n_solutions >= 0 && n_pieces >= 2, false);
+  g_return_val_if_fail(solutions != 0 || n_solutions == 0, false);
+
+  clear();
+
+  JoinContext context;
+
+  context.solutions   = solutions;
+  context.n_solutions = n_solutions;
+  context.n_pieces    = n_pieces;
+  context.n_chunks    = std::max(1, n_threads);
+  context.n_parts     = 4 * context.n_chunks;
+
+  for (int i = 0; i < n_pieces; ++i)
+    for (int k = i + 1; k < n_pieces; ++k)
+      context.pairs.push_back(std::make_pair(i, k));
+
+  context.buckets.resize(context.n_chunks * context.n_parts);
+  context.edges.resize(context.n_parts);
+
+  run_parallel(&emit_keys, context, context.n_chunks, n_threads);
+  run_parallel(&join_partition, context, context.n_parts, n_threads);
+
+  // Lay out the header, the row offsets and the adjacency lists in one
+  // buffer, which is then written out in one go.
+  std::vector<guint32> data (HEADER_SIZE + n_solutions + 1, 0);
+
+  for (int part = 0; part < context.n_parts; ++part)
+    for (EdgeStore::const_iterator p = context.edges[part].begin();
+         p != context.edges[part].end(); ++p)
+      ++data[HEADER_SIZE + p->first + 1];
+
+  for (int i = 0; i < n_solutions; ++i)
+    data[HEADER_SIZE + i + 1] += data[HEADER_SIZE + i];
+
+  const guint32 n_targets = data[HEADER_SIZE + n_solutions];
+
+  data.resize(data.size() + n_targets);
+
+  guint32 *const offsets = &data[HEADER_SIZE];
+  guint32 *const targets = offsets + n_solutions + 1;
+
+  std::vector<guint32> fill (offsets, offsets + n_solutions);
+
+  for (int part = 0; part < context.n_parts; ++part)
+  {
+    for (EdgeStore::const_iterator p = context.edges[part].begin();
+         p != context.edges[part].end(); ++p)
+      targets[fill[p->first]++] = p->second;
+
+    EdgeStore().swap(context.edges[part]);
+  }
+
+  for (int i = 0; i < n_solutions; ++i)
+    std::sort(targets + offsets[i], targets + offsets[i + 1]);
+
+  data[0] = GRAPH_MAGIC;
+  data[1] = n_solutions;
+  data[2] = n_targets;
+
+  GError* gerror = 0;
+
+  if (!g_file_set_contents(filename.c_str(), reinterpret_cast<const gchar*>(&data[0]),
+                           data.size() * sizeof(guint32), &gerror))
+  {
+    error = gerror->message;
+    g_error_free(gerror);
+    return false;
+  }
+
+  std::vector<guint32>().swap(data);
+
+  return load(filename, error);
+}
+
+bool NeighborGraph::load(const std::string& filename, std::string& error)
+{
+  clear();
+
+  GError* gerror = 0;
+  GMappedFile *const file = g_mapped_file_new(filename.c_str(), FALSE, &gerror);
+
+  if (!file)
+  {
+    error = gerror->message;
+    g_error_free(gerror);
+    return false;
+  }
+
+  const gsize          size = g_mapped_file_get_length(file);
+  const guint32 *const data = reinterpret_cast<const guint32*>(g_mapped_file_get_contents(file));
+
+  // Check that the counts in the header agree with the size of the file,
+  // as get_degree() and get_neighbors() trust the offsets and targets.
+  if (size < HEADER_SIZE * sizeof(guint32) || data[0] != GRAPH_MAGIC
+      || size != (HEADER_SIZE + gsize(data[1]) + 1 + data[2]) * sizeof(guint32)
+      || data[1] > guint32(G_MAXINT) || data[HEADER_SIZE + data[1]] != data[2]
+      || !check_adjacency(data + HEADER_SIZE, data[1], data[2]))
+  {
+    g_mapped_file_free(file);
+    error = filename + ": not a valid neighbor graph";
+    return false;
+  }
+
+  file_         = file;
+  vertex_count_ = data[1];
+  offsets_      = data + HEADER_SIZE;
+  targets_      = offsets_ + vertex_count_ + 1;
+
+  return true;
+}
+
+} // namespace Somato
@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOMATO_NEIGHBORS_H_INCLUDED
+#define SOMATO_NEIGHBORS_H_INCLUDED
+
+#include "cube.h"
+
+#include <glib.h>
+#include <string>
+
+#include <config.h>
+
+namespace Somato
+{
+
+/*
+ * Graph which connects the solutions of a puzzle that differ in the
+ * placements of exactly two pieces.  Since the pieces fill the figure,
+ * two distinct solutions always differ in at least two placements.
+ *
+ * The adjacency lists are written to a file in compressed sparse row
+ * form and memory-mapped from there, so that graphs of large solution
+ * sets need not stay resident.  The file is in native byte order.
+ */
+class NeighborGraph
+{
+public:
+  NeighborGraph();
+  ~NeighborGraph();
+
+  // Join the solutions, each given as n_pieces consecutive placements,
+  // and save the graph to the file.  More than one thread is only used
+  // if the GLib thread system has been initialized.
+  bool build(const Cube* solutions, int n_solutions, int n_pieces,
+             const std::string& filename, int n_threads, std::string& error);
+
+  bool load(const std::string& filename, std::string& error);
+  void clear();
+
+  int get_vertex_count() const { return vertex_count_; }
+  int get_edge_count() const;
+
+  int get_degree(int vertex) const;
+  const guint32* get_neighbors(int vertex) const;
+
+private:
+  GMappedFile*    file_;
+  const guint32*  offsets_;   // vertex_count + 1 entries into targets_
+  const guint32*  targets_;   // each list sorted in ascending order
+  int             vertex_count_;
+
+  // noncopyable
+  NeighborGraph(const NeighborGraph&);
+  NeighborGraph& operator=(const NeighborGraph&);
+};
+
+} // namespace Somato
+
+#endif /* SOMATO_NEIGHBORS_H_INCLUDED */
@@ -24,8 +24,6 @@
 #include <glibmm/thread.h>
 
 #include <algorithm>
-#include <functional>
-#include <numeric>
 
 #include <config.h>
 
@@ -33,231 +31,164 @@ namespace
 {
 
 using Somato::Cube;
+using Somato::Solution;
 
-#if SOMATO_USE_UNCHECKEDVECTOR
-typedef Util::UncheckedVector<Cube>       PieceStore;
-typedef Util::UncheckedVector<PieceStore> ColumnStore;
-#else
-typedef std::vector<Cube>                 PieceStore;
-typedef std::vector<PieceStore>           ColumnStore;
-#endif
-
-class PuzzleSolver
+/*
+ * Solver front-end which collects the solutions found, until the given
+ * number of solutions has been reached.
+ */
+class SolutionCollector : public Somato::PuzzleSolver
 {
 private:
-  ColumnStore                   columns_;
-  std::vector<Somato::Solution> solutions_;
-  Somato::Solution              state_;
-
-  // noncopyable
-  PuzzleSolver(const PuzzleSolver&);
-  PuzzleSolver& operator=(const PuzzleSolver&);
+  std::vector<Solution>&  solutions_;
+  int                     limit_;
 
-  void recurse(int col, Cube cube);
-  void add_solution();
+protected:
+  virtual bool on_solution(const Cube* pieces, int count);
 
 public:
-  PuzzleSolver();
-  ~PuzzleSolver();
-
-  void execute();
-  std::vector<Somato::Solution>& result() { return solutions_; }
+  SolutionCollector(std::vector<Solution>& solutions, int limit)
+    : solutions_ (solutions), limit_ (limit) {}
 };
 
-/*
- * Cube pieces rearranged for maximum efficiency.  It is about 15 times
- * faster than with the original order from the project description.
- * The cube piece at index 0 should be suitable for use as the anchor.
- */
-static
-const bool cube_piece_data[Somato::CUBE_PIECE_COUNT][3][3][3] =
+bool SolutionCollector::on_solution(const Cube* pieces, int count)
 {
-  { // Piece #6
-    { {1,1,0}, {0,0,0}, {0,0,0} },
-    { {0,1,0}, {0,1,0}, {0,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  },
-  { // Piece #7
-    { {1,1,0}, {0,1,0}, {0,0,0} },
-    { {0,1,0}, {0,0,0}, {0,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  },
-  { // Piece #5
-    { {1,1,0}, {1,0,0}, {0,0,0} },
-    { {0,1,0}, {0,0,0}, {0,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  },
-  { // Piece #4
-    { {1,0,0}, {1,0,0}, {0,0,0} },
-    { {0,0,0}, {1,0,0}, {1,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  },
-  { // Piece #3
-    { {1,0,0}, {1,0,0}, {1,0,0} },
-    { {0,0,0}, {1,0,0}, {0,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  },
-  { // Piece #2
-    { {1,0,0}, {1,0,0}, {1,0,0} },
-    { {1,0,0}, {0,0,0}, {0,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  },
-  { // Piece #1
-    { {1,0,0}, {1,0,0}, {0,0,0} },
-    { {1,0,0}, {0,0,0}, {0,0,0} },
-    { {0,0,0}, {0,0,0}, {0,0,0} }
-  }
-};
+  g_return_val_if_fail(count == Somato::CUBE_PIECE_COUNT, false);
 
-/*
- * Rotate the cube.  This takes care of all orientations possible.
- */
-static
-void compute_rotations(Cube cube, PieceStore& store)
+  solutions_.push_back(Solution());
+  std::copy(pieces, pieces + count, solutions_.back().begin());
+
+  return (limit_ <= 0 || int(solutions_.size()) < limit_);
+}
+
+} // anonymous namespace
+
+namespace Somato
 {
-  for (unsigned int i = 0;; ++i)
-  {
-    Cube temp = cube;
 
-    // Add the 4 possible orientations of each cube side.
-    store.push_back(temp);
-    store.push_back(temp.rotate(Cube::AXIS_Z));
-    store.push_back(temp.rotate(Cube::AXIS_Z));
-    store.push_back(temp.rotate(Cube::AXIS_Z));
+SolutionSet::SolutionSet()
+:
+  columns_  (),
+  counts_   (),
+  size_     (0)
+{}
 
-    if (i == 5)
-      break;
+SolutionSet::~SolutionSet()
+{}
 
-    // Due to the zigzagging performed here, only 5 rotations are
-    // necessary to move each of the 6 cube sides in turn to the front.
-    cube.rotate(Cube::AXIS_X + i % 2);
-  }
+void SolutionSet::swap(SolutionSet& other)
+{
+  columns_.swap(other.columns_);
+  counts_.swap(other.counts_);
+  std::swap(size_, other.size_);
 }
 
 /*
- * Push the Soma block around; into every position respectively rotation
- * imaginable.  Note that the block is assumed to be positioned initially
- * in the (0, 0, 0) corner of the cube.
+ * Take over the zero-terminated placement columns and the subtree counts
+ * computed by the solver.  The source containers are left empty.
  */
-static
-void shuffle_cube_piece(Cube cube, PieceStore& store)
+void SolutionSet::assign(ColumnStore& columns, SubtreeCountStore& counts)
 {
-  // Make sure the piece is positioned where we expect it to be.
-  g_return_if_fail(cube.get(0, 0, 0));
+  g_return_if_fail(columns.size() == CUBE_PIECE_COUNT && counts.size() == CUBE_PIECE_COUNT);
 
-  for (Cube z = cube; z != Cube(); z.shift(Cube::AXIS_Z))
-    for (Cube y = z; y != Cube(); y.shift(Cube::AXIS_Y))
-      for (Cube x = y; x != Cube(); x.shift(Cube::AXIS_X))
-      {
-        compute_rotations(x, store);
-      }
+  columns_.swap(columns);
+  counts_.swap(counts);
+
+  columns.clear();
+  counts.clear();
+
+  size_ = subtree_count(0, Cube());
 }
 
-/*
- * Replace store by a new set of piece placements that contains only those
- * items from the source which cannot be reproduced by rotating any other
- * item.  This is not a universally applicable utility function; the input
- * is assumed to have come straight out of shuffle_cube_piece().
- */
-static
-void filter_rotations(PieceStore& store)
+int SolutionSet::subtree_count(int col, Cube cube) const
 {
-  g_return_if_fail(store.size() % 24 == 0);
+  if (col == CUBE_PIECE_COUNT)
+    return 1;
 
-  PieceStore::iterator pdest = store.begin();
+  const SubtreeCountMap::const_iterator pos = counts_[col].find(cube);
 
-  for (PieceStore::const_iterator p = store.begin(); p != store.end(); p += 24)
-  {
-    *pdest++ = *std::min_element(p, p + 24, Cube::SortPredicate());
-  }
+  g_return_val_if_fail(pos != counts_[col].end(), 0);
 
-  store.erase(pdest, store.end());
+  return pos->second;
 }
 
-PuzzleSolver::PuzzleSolver()
-:
-  columns_    (Somato::CUBE_PIECE_COUNT),
-  solutions_  (),
-  state_      ()
-{}
+/*
+ * Descend straight to the solution at the given index.  At each column,
+ * whole subtrees are skipped by subtracting their solution counts, so
+ * the cost does not depend on the index.
+ */
+Solution SolutionSet::at(int index) const
+{
+  Solution solution;
 
-PuzzleSolver::~PuzzleSolver()
-{}
+  g_return_val_if_fail(index >= 0 && index < size_, solution);
 
-void PuzzleSolver::execute()
-{
-  solutions_.reserve(512);
+  Cube cube;
 
-  for (int i = 0; i < Somato::CUBE_PIECE_COUNT; ++i)
+  for (int col = 0; col < CUBE_PIECE_COUNT; ++col)
   {
-    PieceStore& store = columns_[i];
+    PieceStore::const_iterator row = columns_[col].begin();
 
-    store.reserve(256);
-    shuffle_cube_piece(Cube(cube_piece_data[i]), store);
+    for (;; ++row)
+    {
+      const Cube cell = *row;
 
-    if (i == 0)
-      filter_rotations(store);
+      g_return_val_if_fail(cell != Cube(), solution);
 
-    std::sort(store.begin(), store.end(), Cube::SortPredicate());
-    store.erase(std::unique(store.begin(), store.end()), store.end());
-  }
+      if ((cell & cube) == Cube())
+      {
+        const int count = subtree_count(col + 1, cube | cell);
 
-  const Cube common = std::accumulate(columns_[0].begin(), columns_[0].end(),
-                                      ~Cube(), Util::Intersect<Cube>());
+        if (index < count)
+          break;
 
-  if (common != Cube())
-    for (int i = 1; i < Somato::CUBE_PIECE_COUNT; ++i)
-    {
-      columns_[i].erase(std::remove_if(columns_[i].begin(), columns_[i].end(),
-                                       Util::DoesIntersect<Cube>(common)),
-                        columns_[i].end());
+        index -= count;
+      }
     }
 
-  // Add zero-termination.
-  for (int i = 0; i < Somato::CUBE_PIECE_COUNT; ++i)
-    columns_[i].push_back(Cube());
+    solution[col] = *row;
+    cube |= *row;
+  }
 
-  recurse(0, Cube());
+  return solution;
 }
 
-void PuzzleSolver::recurse(int col, Cube cube)
+/*
+ * Compute the index of a solution in enumeration order, which is the
+ * inverse of at().  Returns -1 if the argument is not part of the set.
+ */
+int SolutionSet::index_of(const Solution& solution) const
 {
-  PieceStore::const_iterator row = columns_[col].begin();
+  if (empty())
+    return -1;
 
-  for (;;)
+  Cube cube;
+  int  index = 0;
+
+  for (int col = 0; col < CUBE_PIECE_COUNT; ++col)
   {
-    const Cube cell = *row;
+    const Cube piece = solution[col];
 
-    ++row;
+    if (piece == Cube() || (piece & cube) != Cube())
+      return -1;
 
-    if ((cell & cube) == Cube())
+    for (PieceStore::const_iterator row = columns_[col].begin(); *row != piece; ++row)
     {
-      if (cell == Cube())
-        break;
+      const Cube cell = *row;
 
-      state_[col] = cell;
+      if (cell == Cube())
+        return -1;
 
-      if (col < Somato::CUBE_PIECE_COUNT - 1)
-        recurse(col + 1, cube | cell);
-      else
-        add_solution();
+      if ((cell & cube) == Cube())
+        index += subtree_count(col + 1, cube | cell);
     }
+
+    cube |= piece;
   }
-}
 
-void PuzzleSolver::add_solution()
-{
-  // This innocent line translates to quite a bit of code.  Moving this
-  // out of recurse() helps the compiler generate optimal code where it
-  // is actually needed.
-  solutions_.push_back(state_);
+  return index;
 }
 
-} // anonymous namespace
-
-namespace Somato
-{
-
 // MS Visual C++ complains about the use of 'this' in an initializer list.
 // However, it harmless in this case as only a base object will be accessed.
 #ifdef _MSC_VER
@@ -266,11 +197,15 @@ namespace Somato
 #endif
 PuzzleThread::PuzzleThread()
 :
-  solutions_    (),
-  signal_done_  (),
-  signal_exit_  (),
-  thread_exit_  (signal_exit_.connect(sigc::mem_fun(*this, &PuzzleThread::on_thread_exit))),
-  thread_       (0)
+  solutions_        (),
+  first_solutions_  (),
+  solution_limit_   (0),
+  time_limit_       (0.0),
+  exhaustive_       (false),
+  signal_done_      (),
+  signal_exit_      (),
+  thread_exit_      (signal_exit_.connect(sigc::mem_fun(*this, &PuzzleThread::on_thread_exit))),
+  thread_           (0)
 {}
 #ifdef _MSC_VER
 # pragma warning(pop)
@@ -293,13 +228,31 @@ void PuzzleThread::run()
   thread_ = Glib::Thread::create(sigc::mem_fun(*this, &PuzzleThread::execute), true);
 }
 
-void PuzzleThread::swap_result(std::vector<Solution>& result)
+/*
+ * Whether the result covers all solutions of the puzzle, i.e. whether
+ * the search ran to completion without hitting any of the limits.
+ */
+bool PuzzleThread::is_exhaustive() const
+{
+  g_return_val_if_fail(thread_ == 0, false);
+
+  return exhaustive_;
+}
+
+void PuzzleThread::swap_result(SolutionSet& result)
 {
   g_return_if_fail(thread_ == 0);
 
   solutions_.swap(result);
 }
 
+void PuzzleThread::swap_first_solutions(std::vector<Solution>& result)
+{
+  g_return_if_fail(thread_ == 0);
+
+  first_solutions_.swap(result);
+}
+
 /*
  * We can get away without any explicit synchronization, as long as the
  * thread is always properly joined in response to its exit notification.
@@ -308,10 +261,28 @@ void PuzzleThread::execute()
 {
   try
   {
-    PuzzleSolver solver;
+    SolutionCollector solver (first_solutions_, solution_limit_);
 
-    solver.execute();
-    solver.result().swap(solutions_);
+    solver.load_soma_cube();
+    solver.set_time_limit(time_limit_);
+
+    if (solution_limit_ > 0 || time_limit_ > 0.0)
+    {
+      exhaustive_ = solver.solve();
+    }
+    else
+    {
+      ColumnStore       columns;
+      SubtreeCountStore counts;
+
+      exhaustive_ = (solver.count() >= 0);
+
+      if (exhaustive_)
+      {
+        solver.swap_index(columns, counts);
+        solutions_.assign(columns, counts);
+      }
+    }
   }
   catch (...)
   {
@@ -23,10 +23,13 @@
 
 #include "array.h"
 #include "cube.h"
+#include "solver.h"
 
 #include <glibmm/dispatcher.h>
 #include <vector>
 
+#include <config.h>
+
 #ifndef SOMATO_HIDE_FROM_INTELLISENSE
 namespace Glib { class Thread; }
 #endif
@@ -38,6 +41,40 @@ enum { CUBE_PIECE_COUNT = 7 };
 
 typedef Util::Array<Cube, CUBE_PIECE_COUNT> Solution;
 
+/*
+ * The set of all puzzle solutions, in enumeration order.  Instead of
+ * materializing every solution, only the piece placement columns and the
+ * per-subtree solution counts are kept.  That is sufficient to jump to
+ * the solution at any index directly, and to map a solution back to its
+ * index, without visiting any of the solutions in between.
+ */
+class SolutionSet
+{
+public:
+  SolutionSet();
+  ~SolutionSet();
+
+  void swap(SolutionSet& other);
+  void assign(ColumnStore& columns, SubtreeCountStore& counts);
+
+  int  size()  const { return size_; }
+  bool empty() const { return (size_ == 0); }
+
+  Solution at(int index) const;
+  int index_of(const Solution& solution) const;
+
+private:
+  ColumnStore       columns_;
+  SubtreeCountStore counts_;
+  int               size_;
+
+  // noncopyable
+  SolutionSet(const SolutionSet&);
+  SolutionSet& operator=(const SolutionSet&);
+
+  int subtree_count(int col, Cube cube) const;
+};
+
 class PuzzleThread
 {
 public:
@@ -46,11 +83,25 @@ public:
 
   sigc::signal<void>& signal_done() { return signal_done_; }
 
+  // With neither limit set, the complete solution set is indexed.  Otherwise
+  // only the first solutions in enumeration order are collected, until the
+  // given number of solutions has been found or the time budget expired.
+  void set_solution_limit(int limit) { solution_limit_ = limit; }
+  int  get_solution_limit() const { return solution_limit_; }
+  void set_time_limit(double seconds) { time_limit_ = seconds; }
+  double get_time_limit() const { return time_limit_; }
+
   void run();
-  void swap_result(std::vector<Solution>& result);
+  bool is_exhaustive() const;
+  void swap_result(SolutionSet& result);
+  void swap_first_solutions(std::vector<Solution>& result);
 
 private:
-  std::vector<Solution> solutions_;
+  SolutionSet           solutions_;
+  std::vector<Solution> first_solutions_;
+  int                   solution_limit_;
+  double                time_limit_;
+  bool                  exhaustive_;
   sigc::signal<void>    signal_done_;
   Glib::Dispatcher      signal_exit_;
   sigc::connection      thread_exit_;
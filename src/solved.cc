@@ -0,0 +1,1152 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * somato-solved answers solution counts for puzzle definitions received
+ * over a Unix domain socket.  Each request is a single line of text:
+ *
+ *   COUNT <figure> <piece> <piece> ...
+ *   COUNT soma
+ *
+ * where figure and pieces are hexadecimal cell masks as defined by the C
+ * interface in somato-solver.h.  The reply is either "OK <count>" or
+ * "ERROR <message>".  Requests from one connection are answered in order.
+ *
+ * Results are cached in memory and on disk, keyed on the canonical form
+ * of the puzzle.  Cache misses are solved on a pool of worker threads, and
+ * identical requests arriving while a solve is in progress wait for the
+ * same result.
+ */
+
+#include "solver.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <config.h>
+
+namespace
+{
+
+using Somato::Cube;
+using Somato::PieceStore;
+
+enum { MAX_LINE_LENGTH = 4096 };
+
+/*
+ * A puzzle definition reduced to canonical form, together with the text
+ * representation used as cache key.
+ */
+struct Puzzle
+{
+  Cube        figure;
+  PieceStore  pieces;
+  std::string key;
+};
+
+static
+bool parse_cells(const char* text, Cube& cells)
+{
+  char* end = 0;
+  const guint64 value = g_ascii_strtoull(text, &end, 16);
+
+  if (end == text || *end != '\0' || value == 0 || (value >> (Cube::N * Cube::N * Cube::N)) != 0)
+    return false;
+
+  cells = Cube::from_bits(Cube::Bits(value));
+  return true;
+}
+
+/*
+ * Parse a request line into a puzzle in canonical form.  On failure, the
+ * reason is stored in error.
+ */
+static
+bool parse_request(const std::string& line, Puzzle& puzzle, std::string& error)
+{
+  gchar** const tokens = g_strsplit_set(line.c_str(), " \t\r", -1);
+  std::vector<const char*> args;
+
+  for (gchar** token = tokens; *token; ++token)
+    if (**token != '\0')
+      args.push_back(*token);
+
+  bool valid = false;
+
+  if (args.empty() || std::strcmp(args[0], "COUNT") != 0)
+  {
+    error = "unknown request";
+  }
+  else if (args.size() == 2 && std::strcmp(args[1], "soma") == 0)
+  {
+    Somato::PuzzleSolver soma;
+    soma.load_soma_cube();
+
+    puzzle.figure = soma.get_figure();
+    puzzle.pieces.clear();
+    valid = true;
+  }
+  else if (args.size() < 3)
+  {
+    error = "expected figure and pieces";
+  }
+  else
+  {
+    valid = parse_cells(args[1], puzzle.figure);
+
+    puzzle.pieces.resize(args.size() - 2);
+
+    for (unsigned int i = 2; valid && i < args.size(); ++i)
+      valid = parse_cells(args[i], puzzle.pieces[i - 2]);
+
+    if (!valid)
+      error = "invalid cell mask";
+  }
+
+  g_strfreev(tokens);
+
+  if (!valid)
+    return false;
+
+  puzzle.figure = Somato::canonical_figure(puzzle.figure);
+
+  std::transform(puzzle.pieces.begin(), puzzle.pieces.end(), puzzle.pieces.begin(),
+                 &Somato::canonical_piece);
+
+  std::sort(puzzle.pieces.begin(), puzzle.pieces.end(), Cube::SortPredicate());
+
+  char buf[16];
+
+  g_snprintf(buf, sizeof buf, "%07x", puzzle.figure.to_bits());
+  puzzle.key = buf;
+
+  for (PieceStore::const_iterator p = puzzle.pieces.begin(); p != puzzle.pieces.end(); ++p)
+  {
+    g_snprintf(buf, sizeof buf, "%c%07x", (p == puzzle.pieces.begin()) ? ':' : ',', p->to_bits());
+    puzzle.key += buf;
+  }
+
+  return true;
+}
+
+/*
+ * Set up the solver for a parsed puzzle.  The Soma cube preset is marked
+ * by an empty piece list.
+ */
+static
+void load_puzzle(Somato::PuzzleSolver& solver, const Puzzle& puzzle)
+{
+  if (puzzle.pieces.empty())
+  {
+    solver.load_soma_cube();
+    return;
+  }
+
+  solver.set_figure(puzzle.figure);
+  solver.clear_pieces();
+
+  for (PieceStore::const_iterator p = puzzle.pieces.begin(); p != puzzle.pieces.end(); ++p)
+    solver.add_piece(*p);
+}
+
+/*
+ * Write the whole buffer, unless the peer went away.  Only for use with
+ * blocking sockets.
+ */
+static
+bool write_all(int fd, const std::string& data)
+{
+  const char* pos = data.data();
+  const char* const end = pos + data.size();
+
+  while (pos < end)
+  {
+    const ssize_t count = write(fd, pos, end - pos);
+
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count <= 0)
+      return false;
+
+    pos += count;
+  }
+
+  return true;
+}
+
+static
+bool set_nonblocking(int fd)
+{
+  const int flags = fcntl(fd, F_GETFL);
+
+  return (flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0);
+}
+
+static
+int connect_socket(const std::string& path, std::string& error)
+{
+  sockaddr_un address;
+
+  if (path.size() >= sizeof address.sun_path)
+  {
+    error = "socket path too long";
+    return -1;
+  }
+
+  std::memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, path.c_str());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0)
+  {
+    error = g_strerror(errno);
+
+    if (fd >= 0)
+      close(fd);
+
+    return -1;
+  }
+
+  return fd;
+}
+
+/*
+ * Least recently used cache of solution counts.  Entries are held in
+ * memory, and additionally stored as one small file each in the cache
+ * directory, with the file modification time serving as the access time.
+ * Only to be used from the main thread.
+ */
+class ResultCache
+{
+public:
+  ResultCache(const std::string& directory, int memory_limit, int disk_limit);
+  ~ResultCache();
+
+  bool lookup(const std::string& key, int& count);
+  void insert(const std::string& key, int count);
+
+private:
+  typedef std::list<std::pair<std::string, int> >   EntryList;
+  typedef std::map<std::string, EntryList::iterator> EntryMap;
+
+  EntryList   entries_;
+  EntryMap    index_;
+  std::string directory_;
+  int         memory_limit_;
+  int         disk_limit_;
+  int         disk_count_;
+
+  // noncopyable
+  ResultCache(const ResultCache&);
+  ResultCache& operator=(const ResultCache&);
+
+  void remember(const std::string& key, int count);
+  std::string get_filename(const std::string& key) const;
+  int scan_directory(std::vector<std::pair<time_t, std::string> >* files) const;
+  void trim_directory();
+};
+
+ResultCache::ResultCache(const std::string& directory, int memory_limit, int disk_limit)
+:
+  entries_      (),
+  index_        (),
+  directory_    (directory),
+  memory_limit_ (std::max(1, memory_limit)),
+  disk_limit_   (disk_limit),
+  disk_count_   (0)
+{
+  if (!directory_.empty())
+  {
+    if (g_mkdir_with_parents(directory_.c_str(), 0700) < 0)
+    {
+      g_warning("cannot create cache directory \"%s\": %s",
+                directory_.c_str(), g_strerror(errno));
+      directory_.clear();
+    }
+    else
+    {
+      disk_count_ = scan_directory(0);
+    }
+  }
+}
+
+ResultCache::~ResultCache()
+{}
+
+bool ResultCache::lookup(const std::string& key, int& count)
+{
+  const EntryMap::iterator pos = index_.find(key);
+
+  if (pos != index_.end())
+  {
+    // Move to the front of the list.
+    entries_.splice(entries_.begin(), entries_, pos->second);
+    count = pos->second->second;
+    return true;
+  }
+
+  if (directory_.empty())
+    return false;
+
+  const std::string filename = get_filename(key);
+
+  gchar* contents = 0;
+  bool   found    = false;
+
+  if (g_file_get_contents(filename.c_str(), &contents, 0, 0))
+  {
+    // The first line repeats the key, to guard against hash collisions.
+    const char* const newline = std::strchr(contents, '\n');
+
+    if (newline && key.compare(0, std::string::npos, contents, newline - contents) == 0
+        && std::sscanf(newline + 1, "%d", &count) == 1)
+    {
+      utime(filename.c_str(), 0);
+      remember(key, count);
+      found = true;
+    }
+    g_free(contents);
+  }
+
+  return found;
+}
+
+void ResultCache::insert(const std::string& key, int count)
+{
+  remember(key, count);
+
+  if (directory_.empty())
+    return;
+
+  const std::string filename = get_filename(key);
+  gchar *const contents = g_strdup_printf("%s\n%d\n", key.c_str(), count);
+  GError* error = 0;
+
+  if (g_file_set_contents(filename.c_str(), contents, -1, &error))
+  {
+    if (++disk_count_ > disk_limit_)
+      trim_directory();
+  }
+  else
+  {
+    g_warning("%s", error->message);
+    g_error_free(error);
+  }
+
+  g_free(contents);
+}
+
+void ResultCache::remember(const std::string& key, int count)
+{
+  const EntryMap::iterator pos = index_.find(key);
+
+  if (pos != index_.end())
+  {
+    entries_.splice(entries_.begin(), entries_, pos->second);
+    pos->second->second = count;
+    return;
+  }
+
+  entries_.push_front(EntryList::value_type(key, count));
+  index_[key] = entries_.begin();
+
+  if (int(index_.size()) > memory_limit_)
+  {
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
+/*
+ * File names are derived from a 64-bit FNV-1a hash of the key.
+ */
+std::string ResultCache::get_filename(const std::string& key) const
+{
+  guint64 hash = G_GINT64_CONSTANT(14695981039346656037U);
+
+  for (std::string::const_iterator p = key.begin(); p != key.end(); ++p)
+  {
+    hash ^= guchar(*p);
+    hash *= G_GINT64_CONSTANT(1099511628211U);
+  }
+
+  char name[32];
+  g_snprintf(name, sizeof name, "%016" G_GINT64_MODIFIER "x.count", hash);
+
+  gchar *const path = g_build_filename(directory_.c_str(), name, (char*)0);
+  const std::string result = path;
+  g_free(path);
+
+  return result;
+}
+
+/*
+ * Count the cache files, and optionally collect their access times.
+ */
+int ResultCache::scan_directory(std::vector<std::pair<time_t, std::string> >* files) const
+{
+  GDir *const dir = g_dir_open(directory_.c_str(), 0, 0);
+
+  if (!dir)
+    return 0;
+
+  int count = 0;
+
+  while (const char *const name = g_dir_read_name(dir))
+  {
+    if (!g_str_has_suffix(name, ".count"))
+      continue;
+
+    ++count;
+
+    if (files)
+    {
+      gchar *const path = g_build_filename(directory_.c_str(), name, (char*)0);
+      struct stat info;
+
+      if (stat(path, &info) == 0)
+        files->push_back(std::make_pair(info.st_mtime, std::string(path)));
+
+      g_free(path);
+    }
+  }
+
+  g_dir_close(dir);
+
+  return count;
+}
+
+/*
+ * Remove the least recently used files, down to three quarters of the
+ * limit so that this does not have to be repeated on every insertion.
+ */
+void ResultCache::trim_directory()
+{
+  std::vector<std::pair<time_t, std::string> > files;
+
+  disk_count_ = scan_directory(&files);
+
+  std::sort(files.begin(), files.end());
+
+  const int excess = int(files.size()) - disk_limit_ * 3 / 4;
+
+  for (int i = 0; i < excess; ++i)
+    if (g_unlink(files[i].second.c_str()) == 0)
+      --disk_count_;
+}
+
+/*
+ * The daemon proper.  All bookkeeping happens in the main loop; worker
+ * threads only run the solver on a private copy of the puzzle.
+ */
+class SolveServer
+{
+public:
+  SolveServer(ResultCache& cache, int n_threads, double time_limit);
+  ~SolveServer();
+
+  bool listen(const std::string& path, std::string& error);
+
+private:
+  struct Job;
+
+  struct Client
+  {
+    SolveServer*  server;
+    GIOChannel*   channel;
+    guint         watch;
+    guint         output_watch;
+    int           fd;
+    std::string   input;
+    std::string   output;   // replies the socket did not take yet
+    Job*          job;      // the job this client is waiting for, if any
+    bool          closing;  // close once the pending replies are out
+  };
+
+  struct Job
+  {
+    SolveServer*          server;
+    Somato::PuzzleSolver  solver;
+    Puzzle                puzzle;
+    double                time_limit;
+    int                   count;
+    std::vector<Client*>  waiting;
+  };
+
+  typedef std::map<std::string, Job*> JobMap;
+
+  ResultCache&      cache_;
+  GThreadPool*      pool_;
+  JobMap            jobs_;
+  std::list<Client*> clients_;
+  std::string       path_;
+  double            time_limit_;
+  int               listen_fd_;
+  guint             listen_watch_;
+
+  // noncopyable
+  SolveServer(const SolveServer&);
+  SolveServer& operator=(const SolveServer&);
+
+  void process_input(Client* client);
+  bool handle_request(Client* client, const std::string& line);
+  bool send_reply(Client* client, const std::string& reply);
+  bool flush_output(Client* client);
+  void finish_job(Job* job);
+  void close_client(Client* client);
+
+  static gboolean on_accept(GIOChannel* channel, GIOCondition condition, void* data);
+  static gboolean on_client_input(GIOChannel* channel, GIOCondition condition, void* data);
+  static gboolean on_client_output(GIOChannel* channel, GIOCondition condition, void* data);
+  static gboolean on_job_done(void* data);
+  static void execute_job(void* data, void* user_data);
+};
+
+SolveServer::SolveServer(ResultCache& cache, int n_threads, double time_limit)
+:
+  cache_        (cache),
+  pool_         (g_thread_pool_new(&SolveServer::execute_job, 0, std::max(1, n_threads), FALSE, 0)),
+  jobs_         (),
+  clients_      (),
+  path_         (),
+  time_limit_   (time_limit),
+  listen_fd_    (-1),
+  listen_watch_ (0)
+{}
+
+SolveServer::~SolveServer()
+{
+  if (listen_watch_)
+    g_source_remove(listen_watch_);
+
+  if (listen_fd_ >= 0)
+  {
+    close(listen_fd_);
+    g_unlink(path_.c_str());
+  }
+
+  while (!clients_.empty())
+    close_client(clients_.front());
+
+  // Cancel the solves in progress, so that the workers run dry quickly.
+  for (JobMap::iterator p = jobs_.begin(); p != jobs_.end(); ++p)
+    p->second->solver.cancel();
+
+  g_thread_pool_free(pool_, FALSE, TRUE);
+
+  // Each job has queued its on_job_done() handler by now, which in turn
+  // deletes the job.  Counts completed before the shutdown are cached.
+  while (!jobs_.empty())
+    g_main_context_iteration(0, TRUE);
+}
+
+bool SolveServer::listen(const std::string& path, std::string& error)
+{
+  g_return_val_if_fail(listen_fd_ < 0, false);
+
+  sockaddr_un address;
+
+  if (path.size() >= sizeof address.sun_path)
+  {
+    error = "socket path too long";
+    return false;
+  }
+
+  // A live daemon would answer; otherwise the socket is a leftover.
+  std::string dummy;
+  const int peer = connect_socket(path, dummy);
+
+  if (peer >= 0)
+  {
+    close(peer);
+    error = "another daemon is listening on " + path;
+    return false;
+  }
+  g_unlink(path.c_str());
+
+  std::memset(&address, 0, sizeof address);
+  address.sun_family = AF_UNIX;
+  std::strcpy(address.sun_path, path.c_str());
+
+  listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  if (listen_fd_ < 0 || !set_nonblocking(listen_fd_)
+      || bind(listen_fd_, reinterpret_cast<sockaddr*>(&address), sizeof address) < 0
+      || ::listen(listen_fd_, SOMAXCONN) < 0)
+  {
+    error = g_strerror(errno);
+
+    if (listen_fd_ >= 0)
+      close(listen_fd_);
+
+    listen_fd_ = -1;
+    return false;
+  }
+
+  path_ = path;
+
+  GIOChannel *const channel = g_io_channel_unix_new(listen_fd_);
+  listen_watch_ = g_io_add_watch(channel, G_IO_IN, &SolveServer::on_accept, this);
+  g_io_channel_unref(channel);
+
+  return true;
+}
+
+// static
+gboolean SolveServer::on_accept(GIOChannel*, GIOCondition, void* data)
+{
+  SolveServer *const self = static_cast<SolveServer*>(data);
+
+  const int fd = accept(self->listen_fd_, 0, 0);
+
+  if (fd < 0)
+  {
+    if (errno != EINTR && errno != EAGAIN)
+      g_warning("accept: %s", g_strerror(errno));
+
+    return TRUE;
+  }
+
+  // Replies are queued rather than allowed to block the main loop.
+  if (!set_nonblocking(fd))
+  {
+    g_warning("fcntl: %s", g_strerror(errno));
+    close(fd);
+    return TRUE;
+  }
+
+  Client *const client = new Client();
+
+  client->server       = self;
+  client->channel      = g_io_channel_unix_new(fd);
+  client->output_watch = 0;
+  client->fd           = fd;
+  client->job          = 0;
+  client->closing      = false;
+  client->watch        = g_io_add_watch(client->channel, GIOCondition(G_IO_IN | G_IO_HUP | G_IO_ERR),
+                                        &SolveServer::on_client_input, client);
+
+  self->clients_.push_back(client);
+
+  return TRUE;
+}
+
+// static
+gboolean SolveServer::on_client_input(GIOChannel*, GIOCondition, void* data)
+{
+  Client *const client = static_cast<Client*>(data);
+  char buf[1024];
+
+  const ssize_t count = read(client->fd, buf, sizeof buf);
+
+  if (count < 0 && (errno == EINTR || errno == EAGAIN))
+    return TRUE;
+
+  // The watch is removed by returning FALSE.
+  if (count == 0 && (client->job || !client->output.empty()))
+  {
+    // The peer may have shut down just its end; answer what is pending.
+    client->watch   = 0;
+    client->closing = true;
+    return FALSE;
+  }
+
+  if (count <= 0 || client->input.size() + count > MAX_LINE_LENGTH * 16)
+  {
+    client->watch = 0;
+    client->server->close_client(client);
+    return FALSE;
+  }
+
+  // Anything after a request which ended the session is ignored.
+  if (!client->closing)
+  {
+    client->input.append(buf, count);
+    client->server->process_input(client);
+  }
+
+  return TRUE;
+}
+
+/*
+ * Handle complete request lines, one at a time.  While a request awaits
+ * its result, further input is left alone so that replies stay in order.
+ * The same goes for replies the client has not taken yet.
+ */
+void SolveServer::process_input(Client* client)
+{
+  while (!client->job && client->output.empty())
+  {
+    const std::string::size_type newline = client->input.find('\n');
+
+    if (newline == std::string::npos)
+      break;
+
+    const std::string line (client->input, 0, newline);
+    client->input.erase(0, newline + 1);
+
+    if (!handle_request(client, line))
+      break;
+  }
+}
+
+/*
+ * Returns false if the client has been closed, or is about to be.
+ */
+bool SolveServer::handle_request(Client* client, const std::string& line)
+{
+  if (line.size() > MAX_LINE_LENGTH)
+  {
+    client->input.clear();
+    client->closing = true;
+    send_reply(client, "ERROR request too long\n");
+    return false;
+  }
+
+  Puzzle      puzzle;
+  std::string error;
+  int         count = 0;
+
+  if (!parse_request(line, puzzle, error))
+    return send_reply(client, "ERROR " + error + '\n');
+
+  if (cache_.lookup(puzzle.key, count))
+  {
+    char reply[32];
+    g_snprintf(reply, sizeof reply, "OK %d\n", count);
+
+    return send_reply(client, reply);
+  }
+
+  const JobMap::iterator pos = jobs_.find(puzzle.key);
+  Job* job = 0;
+
+  if (pos != jobs_.end())
+  {
+    // Identical puzzle already in progress; simply wait for its result.
+    job = pos->second;
+  }
+  else
+  {
+    job = new Job();
+
+    job->server     = this;
+    job->puzzle     = puzzle;
+    job->time_limit = time_limit_;
+    job->count      = -1;
+
+    jobs_[puzzle.key] = job;
+    g_thread_pool_push(pool_, job, 0);
+  }
+
+  job->waiting.push_back(client);
+  client->job = job;
+
+  return true;
+}
+
+/*
+ * Queue the reply, and write as much of the pending output as the socket
+ * takes right away.  Returns false if the client has been closed.
+ */
+bool SolveServer::send_reply(Client* client, const std::string& reply)
+{
+  client->output += reply;
+
+  return flush_output(client);
+}
+
+/*
+ * Write the pending output without blocking, and leave the rest to a
+ * G_IO_OUT watch.  Returns false if the client has been closed, due to
+ * an error or because it is done.  A closing client is done once there
+ * is neither output nor a complete request left.
+ */
+bool SolveServer::flush_output(Client* client)
+{
+  while (!client->output.empty())
+  {
+    const ssize_t count = write(client->fd, client->output.data(), client->output.size());
+
+    if (count < 0 && errno == EINTR)
+      continue;
+    if (count < 0 && errno == EAGAIN)
+      break;
+
+    if (count <= 0)
+    {
+      close_client(client);
+      return false;
+    }
+
+    client->output.erase(0, count);
+  }
+
+  if (!client->output.empty())
+  {
+    if (!client->output_watch)
+      client->output_watch = g_io_add_watch(client->channel, G_IO_OUT,
+                                            &SolveServer::on_client_output, client);
+  }
+  else if (client->closing && !client->job && client->input.find('\n') == std::string::npos)
+  {
+    close_client(client);
+    return false;
+  }
+
+  return true;
+}
+
+// static
+gboolean SolveServer::on_client_output(GIOChannel*, GIOCondition, void* data)
+{
+  Client *const client = static_cast<Client*>(data);
+
+  // The watch is removed by returning FALSE, and added anew if needed.
+  client->output_watch = 0;
+
+  if (client->server->flush_output(client) && client->output.empty())
+    client->server->process_input(client);
+
+  return FALSE;
+}
+
+/*
+ * Runs in a worker thread.  The job is handed back to the main loop once
+ * the count is known.
+ */
+// static
+void SolveServer::execute_job(void* data, void*)
+{
+  Job *const job = static_cast<Job*>(data);
+
+  Somato::PuzzleSolver& solver = job->solver;
+
+  load_puzzle(solver, job->puzzle);
+  solver.set_time_limit(job->time_limit);
+  solver.set_propagation(true);
+  solver.set_parity_pruning(true);
+
+  job->count = solver.count();
+
+  g_idle_add(&SolveServer::on_job_done, job);
+}
+
+// static
+gboolean SolveServer::on_job_done(void* data)
+{
+  Job *const job = static_cast<Job*>(data);
+
+  job->server->finish_job(job);
+
+  return FALSE; // disconnect
+}
+
+void SolveServer::finish_job(Job* job)
+{
+  jobs_.erase(job->puzzle.key);
+
+  char reply[64];
+
+  if (job->count >= 0)
+  {
+    cache_.insert(job->puzzle.key, job->count);
+    g_snprintf(reply, sizeof reply, "OK %d\n", job->count);
+  }
+  else
+  {
+    g_snprintf(reply, sizeof reply, "ERROR time limit exceeded\n");
+  }
+
+  const std::vector<Client*> waiting (job->waiting);
+  delete job;
+
+  for (std::vector<Client*>::const_iterator p = waiting.begin(); p != waiting.end(); ++p)
+  {
+    Client *const client = *p;
+
+    client->job = 0;
+
+    if (send_reply(client, reply))
+      process_input(client);
+  }
+}
+
+void SolveServer::close_client(Client* client)
+{
+  if (client->job)
+  {
+    std::vector<Client*>& waiting = client->job->waiting;
+    waiting.erase(std::remove(waiting.begin(), waiting.end(), client), waiting.end());
+  }
+
+  clients_.remove(client);
+
+  if (client->watch)
+    g_source_remove(client->watch);
+
+  if (client->output_watch)
+    g_source_remove(client->output_watch);
+
+  g_io_channel_unref(client->channel);
+  close(client->fd);
+
+  delete client;
+}
+
+/*
+ * Client mode: send each request and print the reply.
+ */
+static
+int run_query(const std::string& path, const std::vector<std::string>& requests)
+{
+  std::string error;
+  const int fd = connect_socket(path, error);
+
+  if (fd < 0)
+  {
+    g_printerr("%s: %s\n", path.c_str(), error.c_str());
+    return 1;
+  }
+
+  FILE *const input = fdopen(fd, "r");
+  char reply[MAX_LINE_LENGTH];
+  int status = 0;
+
+  for (std::vector<std::string>::const_iterator p = requests.begin(); p != requests.end(); ++p)
+  {
+    if (!write_all(fd, *p + '\n') || !std::fgets(reply, sizeof reply, input))
+    {
+      g_printerr("%s: connection lost\n", path.c_str());
+      status = 1;
+      break;
+    }
+
+    std::fputs(reply, stdout);
+
+    if (!g_str_has_prefix(reply, "OK"))
+      status = 1;
+  }
+
+  std::fclose(input);
+
+  return status;
+}
+
+/*
+ * The signal handler merely writes to this pipe, which wakes up the main
+ * loop.  GLib has no means to watch for signals directly.
+ */
+static int quit_pipe[2] = { -1, -1 };
+
+static
+void on_quit_signal(int)
+{
+  const int  saved_errno = errno;
+  const char byte        = 0;
+
+  if (write(quit_pipe[1], &byte, 1) < 0)
+  {} // the pipe is full, thus the main loop has been told already
+
+  errno = saved_errno;
+}
+
+static
+gboolean on_quit_request(GIOChannel*, GIOCondition, void* data)
+{
+  g_main_loop_quit(static_cast<GMainLoop*>(data));
+
+  return FALSE; // disconnect
+}
+
+/*
+ * Make SIGINT and SIGTERM quit the main loop, so that the daemon shuts
+ * down in an orderly fashion.
+ */
+static
+bool watch_quit_signals(GMainLoop* loop)
+{
+  if (pipe(quit_pipe) < 0 || !set_nonblocking(quit_pipe[0]) || !set_nonblocking(quit_pipe[1]))
+    return false;
+
+  GIOChannel *const channel = g_io_channel_unix_new(quit_pipe[0]);
+  g_io_add_watch(channel, G_IO_IN, &on_quit_request, loop);
+  g_io_channel_unref(channel);
+
+  signal(SIGINT,  &on_quit_signal);
+  signal(SIGTERM, &on_quit_signal);
+
+  return true;
+}
+
+} // anonymous namespace
+
+int main(int argc, char** argv)
+{
+  g_thread_init(0);
+  g_set_prgname("somato-solved");
+
+  gchar*    socket_path  = 0;
+  gchar*    cache_dir    = 0;
+  gboolean  query        = FALSE;
+  gboolean  no_disk      = FALSE;
+  int       n_threads    = 0;
+  int       memory_limit = 4096;
+  int       disk_limit   = 65536;
+  double    time_limit   = 0.0;
+
+  const GOptionEntry entries[] =
+  {
+    { "socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_path,
+      "Unix domain socket to listen on", "PATH" },
+    { "cache-dir", 'c', 0, G_OPTION_ARG_FILENAME, &cache_dir,
+      "Directory for the on-disk cache", "DIR" },
+    { "no-disk-cache", 0, 0, G_OPTION_ARG_NONE, &no_disk,
+      "Keep results in memory only", 0 },
+    { "memory-entries", 0, 0, G_OPTION_ARG_INT, &memory_limit,
+      "Number of results to keep in memory", "N" },
+    { "disk-entries", 0, 0, G_OPTION_ARG_INT, &disk_limit,
+      "Number of results to keep on disk", "N" },
+    { "threads", 'j', 0, G_OPTION_ARG_INT, &n_threads,
+      "Number of worker threads", "N" },
+    { "time-limit", 't', 0, G_OPTION_ARG_DOUBLE, &time_limit,
+      "Give up on puzzles taking longer than this", "SECONDS" },
+    { "query", 'q', 0, G_OPTION_ARG_NONE, &query,
+      "Send requests to a running daemon and print the replies", 0 },
+    { 0, 0, 0, G_OPTION_ARG_NONE, 0, 0, 0 }
+  };
+
+  GOptionContext *const context = g_option_context_new("- Somato puzzle solver daemon");
+  GError* error = 0;
+
+  g_option_context_add_main_entries(context, entries, 0);
+
+  if (!g_option_context_parse(context, &argc, &argv, &error))
+  {
+    g_printerr("%s\n", error->message);
+    return 1;
+  }
+  g_option_context_free(context);
+
+  std::string path;
+
+  if (socket_path)
+  {
+    path = socket_path;
+  }
+  else
+  {
+    const std::string name = std::string("somato-solved-") + g_get_user_name();
+    gchar *const filename = g_build_filename(g_get_tmp_dir(), name.c_str(), (char*)0);
+    path = filename;
+    g_free(filename);
+  }
+
+  if (query)
+  {
+    // Requests are taken from the command line, or else from stdin.
+    std::vector<std::string> requests;
+
+    if (argc > 1)
+    {
+      std::string request;
+
+      for (int i = 1; i < argc; ++i)
+        request.append((i > 1) ? " " : "").append(argv[i]);
+
+      requests.push_back(request);
+    }
+    else
+    {
+      char line[MAX_LINE_LENGTH];
+
+      while (std::fgets(line, sizeof line, stdin))
+      {
+        g_strchomp(line);
+
+        if (*line != '\0')
+          requests.push_back(line);
+      }
+    }
+
+    return run_query(path, requests);
+  }
+
+  std::string directory;
+
+  if (!no_disk)
+  {
+    if (cache_dir)
+    {
+      directory = cache_dir;
+    }
+    else
+    {
+      gchar *const filename = g_build_filename(g_get_user_cache_dir(), "somato", (char*)0);
+      directory = filename;
+      g_free(filename);
+    }
+  }
+
+  if (n_threads <= 0)
+    n_threads = std::max(1, int(sysconf(_SC_NPROCESSORS_ONLN)));
+
+  signal(SIGPIPE, SIG_IGN);
+
+  ResultCache cache (directory, memory_limit, disk_limit);
+  SolveServer server (cache, n_threads, time_limit);
+  std::string message;
+
+  if (!server.listen(path, message))
+  {
+    g_printerr("%s: %s\n", path.c_str(), message.c_str());
+    return 1;
+  }
+
+  GMainLoop *const loop = g_main_loop_new(0, FALSE);
+
+  if (!watch_quit_signals(loop))
+    g_warning("pipe: %s", g_strerror(errno));
+
+  g_main_loop_run(loop);
+  g_main_loop_unref(loop);
+
+  return 0;
+}
@@ -0,0 +1,1784 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "solver.h"
+#include "array.h"
+#include "diagram.h"
+#include "lanemask.h"
+#include "somato-solver.h"
+
+#include <glib.h>
+
+#if SOMATO_VECTOR_USE_SSE2
+# include <emmintrin.h>
+#endif
+#if SOMATO_HAVE_AVX2_DISPATCH
+# include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <numeric>
+
+#include <config.h>
+
+namespace
+{
+
+using Somato::Cube;
+using Somato::PieceStore;
+
+/*
+ * Number of search nodes to expand between checks of the time limit and
+ * of cancellation requests.  Must be a power of two.
+ */
+enum { CHECK_INTERVAL = 1024 };
+
+/*
+ * Cube pieces rearranged for maximum efficiency.  It is about 15 times
+ * faster than with the original order from the project description.
+ * The cube piece at index 0 should be suitable for use as the anchor.
+ */
+static
+const bool cube_piece_data[][3][3][3] =
+{
+  { // Piece #6
+    { {1,1,0}, {0,0,0}, {0,0,0} },
+    { {0,1,0}, {0,1,0}, {0,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  },
+  { // Piece #7
+    { {1,1,0}, {0,1,0}, {0,0,0} },
+    { {0,1,0}, {0,0,0}, {0,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  },
+  { // Piece #5
+    { {1,1,0}, {1,0,0}, {0,0,0} },
+    { {0,1,0}, {0,0,0}, {0,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  },
+  { // Piece #4
+    { {1,0,0}, {1,0,0}, {0,0,0} },
+    { {0,0,0}, {1,0,0}, {1,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  },
+  { // Piece #3
+    { {1,0,0}, {1,0,0}, {1,0,0} },
+    { {0,0,0}, {1,0,0}, {0,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  },
+  { // Piece #2
+    { {1,0,0}, {1,0,0}, {1,0,0} },
+    { {1,0,0}, {0,0,0}, {0,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  },
+  { // Piece #1
+    { {1,0,0}, {1,0,0}, {0,0,0} },
+    { {1,0,0}, {0,0,0}, {0,0,0} },
+    { {0,0,0}, {0,0,0}, {0,0,0} }
+  }
+};
+
+/*
+ * Rotate the cube.  This takes care of all orientations possible.
+ */
+static
+void compute_rotations(Cube cube, PieceStore& store)
+{
+  for (unsigned int i = 0;; ++i)
+  {
+    Cube temp = cube;
+
+    // Add the 4 possible orientations of each cube side.
+    store.push_back(temp);
+    store.push_back(temp.rotate(Cube::AXIS_Z));
+    store.push_back(temp.rotate(Cube::AXIS_Z));
+    store.push_back(temp.rotate(Cube::AXIS_Z));
+
+    if (i == 5)
+      break;
+
+    // Due to the zigzagging performed here, only 5 rotations are
+    // necessary to move each of the 6 cube sides in turn to the front.
+    cube.rotate(Cube::AXIS_X + i % 2);
+  }
+}
+
+/*
+ * Move the piece as close to the (0, 0, 0) corner as it will go.
+ */
+static
+Cube align_cube_piece(Cube piece)
+{
+  static const Cube::Bits all_cells = ~(~Cube::Bits(1) << (Cube::N * Cube::N * Cube::N - 1));
+
+  // The cells of the lowest layer along each axis.
+  static const Cube::Bits first_layer[3] =
+  {
+    ~(~Cube::Bits(0) << Cube::N * Cube::N),
+    all_cells / ~(~Cube::Bits(1) << (Cube::N * Cube::N - 1)) * ~(~Cube::Bits(0) << Cube::N),
+    all_cells / ~(~Cube::Bits(1) << (Cube::N - 1))
+  };
+  static const unsigned char layer_shift[3] = { Cube::N * Cube::N, Cube::N, 1 };
+
+  Cube::Bits bits = piece.to_bits();
+
+  if (bits != 0)
+    for (int axis = 0; axis < 3; ++axis)
+      while ((bits & first_layer[axis]) == 0)
+        bits >>= layer_shift[axis];
+
+  return Cube::from_bits(bits);
+}
+
+static
+int count_cells(Cube cube)
+{
+  int count = 0;
+
+  for (Cube::Bits bits = cube.to_bits(); bits != 0; bits &= bits - 1)
+    ++count;
+
+  return count;
+}
+
+/*
+ * For each piece, find the index of the last piece before it which has the
+ * same shape, or -1 if there is none.
+ */
+static
+void find_twins(const PieceStore& pieces, std::vector<int>& twins)
+{
+  PieceStore shapes;
+  std::transform(pieces.begin(), pieces.end(), std::back_inserter(shapes),
+                 &Somato::canonical_piece);
+
+  twins.assign(pieces.size(), -1);
+
+  for (unsigned int i = 1; i < shapes.size(); ++i)
+    for (int k = i - 1; k >= 0; --k)
+      if (shapes[k] == shapes[i])
+      {
+        twins[i] = k;
+        break;
+      }
+}
+
+/*
+ * Pick the first piece whose shape no other piece shares as the anchor,
+ * i.e. the piece restricted by the rotation filter.  A piece with twins
+ * does not qualify, as the filter would then hold for whichever of them
+ * the twin ordering puts first, and a class of solutions would be counted
+ * more than once.  Returns -1 if every shape occurs repeatedly.
+ */
+static
+int find_anchor(const std::vector<int>& twins)
+{
+  for (unsigned int i = 0; i < twins.size(); ++i)
+    if (twins[i] < 0 && std::find(twins.begin(), twins.end(), int(i)) == twins.end())
+      return i;
+
+  return -1;
+}
+
+/*
+ * Find the indices of the rotations, in the order of compute_rotations(),
+ * which map the figure onto itself.  The identity is left out.
+ */
+static
+void find_symmetries(Cube figure, std::vector<int>& symmetries)
+{
+  PieceStore rotations;
+  compute_rotations(figure, rotations);
+
+  symmetries.clear();
+
+  for (unsigned int i = 1; i < rotations.size(); ++i)
+    if (rotations[i] == figure)
+      symmetries.push_back(i);
+}
+
+/*
+ * Check whether the solution, taken as a set of placements, is the least
+ * of its images under the symmetries of the figure.  This picks a single
+ * solution out of each class when no anchor is available.
+ */
+static
+bool is_least_image(const Cube* solution, int n_pieces, const std::vector<int>& symmetries)
+{
+  PieceStore sorted (solution, solution + n_pieces);
+  std::sort(sorted.begin(), sorted.end(), Cube::SortPredicate());
+
+  PieceStore image (n_pieces);
+  PieceStore rotations;
+
+  for (std::vector<int>::const_iterator s = symmetries.begin(); s != symmetries.end(); ++s)
+  {
+    for (int i = 0; i < n_pieces; ++i)
+    {
+      rotations.clear();
+      compute_rotations(solution[i], rotations);
+      image[i] = rotations[*s];
+    }
+
+    std::sort(image.begin(), image.end(), Cube::SortPredicate());
+
+    if (std::lexicographical_compare(image.begin(), image.end(), sorted.begin(), sorted.end(),
+                                     Cube::SortPredicate()))
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Open addressing hash set of cube masks.  The empty cube marks unused
+ * slots and thus cannot be a member, which is no restriction for sets
+ * of piece placements.
+ */
+class CubeSet
+{
+private:
+  struct Hash
+  {
+    // Multiplicative hashing with the high bits folded back in, so that the
+    // neighboring placements produced by shifting a piece spread out evenly.
+    unsigned int operator()(Cube::Bits bits) const
+    {
+      const unsigned int h = bits * 2654435769U;
+      return h ^ (h >> 16);
+    }
+  };
+
+  Util::ProbeTable<Cube::Bits> slots_;
+
+  // noncopyable
+  CubeSet(const CubeSet&);
+  CubeSet& operator=(const CubeSet&);
+
+  static unsigned int slot_count(unsigned int capacity);
+
+public:
+  explicit CubeSet(unsigned int capacity = 0) : slots_ (slot_count(capacity)) {}
+
+  bool insert(Cube cube); // returns false if already present
+  bool contains(Cube cube) const
+    { return (slots_[slots_.find_slot(cube.to_bits(), Hash(), std::equal_to<Cube::Bits>())] != 0); }
+};
+
+// static
+unsigned int CubeSet::slot_count(unsigned int capacity)
+{
+  unsigned int n_slots = 16;
+
+  while (n_slots < 2 * capacity)
+    n_slots *= 2;
+
+  return n_slots;
+}
+
+bool CubeSet::insert(Cube cube)
+{
+  g_return_val_if_fail(cube != Cube(), false);
+
+  const Cube::Bits   bits = cube.to_bits();
+  const unsigned int slot = slots_.find_slot(bits, Hash(), std::equal_to<Cube::Bits>());
+
+  if (slots_[slot] != 0)
+    return false;
+
+  slots_.insert(slot, bits, bits, Hash());
+
+  return true;
+}
+
+/*
+ * Push the Soma block around; into every position respectively rotation
+ * imaginable, as long as it stays within the figure.  Orientations which
+ * coincide due to symmetries of the block itself are weeded out before
+ * shifting them across the cube, thus no placement is produced twice.
+ */
+static
+void shuffle_cube_piece(Cube piece, Cube figure, PieceStore& store)
+{
+  PieceStore rotations;
+  compute_rotations(piece, rotations);
+
+  CubeSet orientations (rotations.size());
+
+  for (PieceStore::const_iterator p = rotations.begin(); p != rotations.end(); ++p)
+  {
+    const Cube cube = align_cube_piece(*p);
+
+    if (!orientations.insert(cube))
+      continue;
+
+    for (Cube z = cube; z != Cube(); z.shift(Cube::AXIS_Z))
+      for (Cube y = z; y != Cube(); y.shift(Cube::AXIS_Y))
+        for (Cube x = y; x != Cube(); x.shift(Cube::AXIS_X))
+        {
+          if ((x & ~figure) == Cube())
+            store.push_back(x);
+        }
+  }
+}
+
+/*
+ * Remove each placement from the sorted store which can be reproduced by
+ * applying one of the figure's symmetries to a lesser placement.  Hence
+ * only the least member of each orbit remains.
+ */
+static
+void filter_rotations(PieceStore& store, Cube figure)
+{
+  // compute_rotations() applies the same sequence of rotations to any
+  // input, so the rotations of the figure tell which of them are symmetries.
+  PieceStore symmetry;
+  compute_rotations(figure, symmetry);
+
+  PieceStore rotations;
+  CubeSet    covered (store.size());
+
+  PieceStore::iterator pdest = store.begin();
+
+  for (PieceStore::const_iterator p = store.begin(); p != store.end(); ++p)
+  {
+    if (covered.contains(*p))
+      continue;
+
+    *pdest++ = *p;
+
+    rotations.clear();
+    compute_rotations(*p, rotations);
+
+    for (unsigned int i = 1; i < rotations.size(); ++i)
+      if (symmetry[i] == figure)
+        covered.insert(rotations[i]);
+  }
+
+  store.erase(pdest, store.end());
+}
+
+/*
+ * Signature of the candidate scan implementations below.
+ */
+typedef int (*ScanColumnFunc)(const Cube* rows, int n_rows, Cube cube, Cube* out);
+
+/*
+ * For each 4-bit mask of fitting rows, the positions of the rows to keep
+ * in order, followed by their number.  The positions beyond the count are
+ * don't-cares, so that four rows can always be copied unconditionally.
+ */
+static
+const unsigned char compress_table[16][5] =
+{
+  {0,0,0,0, 0}, {0,0,0,0, 1}, {1,0,0,0, 1}, {0,1,0,0, 2},
+  {2,0,0,0, 1}, {0,2,0,0, 2}, {1,2,0,0, 2}, {0,1,2,0, 3},
+  {3,0,0,0, 1}, {0,3,0,0, 2}, {1,3,0,0, 2}, {0,1,3,0, 3},
+  {2,3,0,0, 2}, {0,2,3,0, 3}, {1,2,3,0, 3}, {0,1,2,3, 4}
+};
+
+/*
+ * Append the rows selected by the 4-bit mask fit to dest.  Writes four
+ * items regardless, and returns the position past the last one kept.
+ */
+static inline
+Cube* compress_rows(const Cube* rows, int fit, Cube* dest)
+{
+  const unsigned char *const order = compress_table[fit];
+
+  dest[0] = rows[order[0]];
+  dest[1] = rows[order[1]];
+  dest[2] = rows[order[2]];
+  dest[3] = rows[order[3]];
+
+  return dest + order[4];
+}
+
+/*
+ * Copy those of the n_rows placements which do not intersect with cube
+ * to out, keeping their order.  Returns the number of placements copied.
+ * The output buffer must have room for all rows, as items not kept may be
+ * written to it as well.
+ */
+static
+int scan_column(const Cube* rows, int n_rows, Cube cube, Cube* out)
+{
+  Cube* dest = out;
+
+  for (int i = 0; i < n_rows; ++i)
+  {
+    const Cube cell = rows[i];
+
+    *dest = cell;
+    dest += ((cell & cube) == Cube());
+  }
+
+  return dest - out;
+}
+
+#if SOMATO_VECTOR_USE_SSE2
+/*
+ * Test four placements at a time, and compact the ones fitting with the
+ * help of the compression table.
+ */
+static
+int scan_column_sse2(const Cube* rows, int n_rows, Cube cube, Cube* out)
+{
+  const __m128i mask = _mm_set1_epi32(cube.to_bits());
+  const __m128i zero = _mm_setzero_si128();
+
+  Cube* dest = out;
+  int   i    = 0;
+
+  for (; i + 4 <= n_rows; i += 4)
+  {
+    const __m128i cells = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows + i));
+    const __m128i empty = _mm_cmpeq_epi32(_mm_and_si128(cells, mask), zero);
+
+    dest = compress_rows(rows + i, _mm_movemask_ps(_mm_castsi128_ps(empty)), dest);
+  }
+
+  return (dest - out) + scan_column(rows + i, n_rows - i, cube, dest);
+}
+#endif /* SOMATO_VECTOR_USE_SSE2 */
+
+#if SOMATO_HAVE_AVX2_DISPATCH
+/*
+ * Same as above, but eight placements at a time.  Compiled for AVX2 no
+ * matter what the rest of the code targets, and only called if the CPU
+ * supports it.
+ */
+__attribute__((__target__("avx2")))
+static
+int scan_column_avx2(const Cube* rows, int n_rows, Cube cube, Cube* out)
+{
+  const __m256i mask = _mm256_set1_epi32(cube.to_bits());
+  const __m256i zero = _mm256_setzero_si256();
+
+  Cube* dest = out;
+  int   i    = 0;
+
+  for (; i + 8 <= n_rows; i += 8)
+  {
+    const __m256i cells = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i));
+    const __m256i empty = _mm256_cmpeq_epi32(_mm256_and_si256(cells, mask), zero);
+    const int     fit   = _mm256_movemask_ps(_mm256_castsi256_ps(empty));
+
+    if (fit != 0)
+    {
+      dest = compress_rows(rows + i,     fit & 0xF, dest);
+      dest = compress_rows(rows + i + 4, fit >> 4,  dest);
+    }
+  }
+
+  return (dest - out) + scan_column(rows + i, n_rows - i, cube, dest);
+}
+#endif /* SOMATO_HAVE_AVX2_DISPATCH */
+
+/*
+ * Whether the code compiled for AVX2 may be run on this CPU.
+ */
+static
+bool have_avx2()
+{
+#if SOMATO_HAVE_AVX2_DISPATCH
+  __builtin_cpu_init();
+
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+/*
+ * Pick the fastest candidate scan the CPU is able to execute.
+ */
+static
+ScanColumnFunc select_scan_column()
+{
+#if SOMATO_HAVE_AVX2_DISPATCH
+  if (have_avx2())
+    return &scan_column_avx2;
+#endif
+#if SOMATO_VECTOR_USE_SSE2
+  return &scan_column_sse2;
+#else
+  return &scan_column;
+#endif
+}
+
+} // anonymous namespace
+
+namespace Somato
+{
+
+Cube canonical_figure(Cube figure)
+{
+  PieceStore rotations;
+  compute_rotations(figure, rotations);
+
+  return *std::min_element(rotations.begin(), rotations.end(), Cube::SortPredicate());
+}
+
+Cube canonical_piece(Cube piece)
+{
+  PieceStore rotations;
+  compute_rotations(piece, rotations);
+
+  std::transform(rotations.begin(), rotations.end(), rotations.begin(), &align_cube_piece);
+
+  return *std::min_element(rotations.begin(), rotations.end(), Cube::SortPredicate());
+}
+
+void find_placements(Cube piece, Cube figure, PieceStore& store)
+{
+  shuffle_cube_piece(piece, figure, store);
+}
+
+PuzzleSolver::PuzzleSolver()
+:
+  pieces_           (),
+  columns_          (),
+  counts_           (),
+  state_            (),
+  fixed_            (),
+  candidates_       (),
+  twins_            (),
+  memoize_          (),
+  symmetries_       (),
+  color_sums_       (),
+  timer_            (g_timer_new()),
+  scan_column_      (select_scan_column()),
+  figure_           (~Cube()),
+  anchor_           (-1),
+  time_limit_       (0.0),
+  elapsed_          (0.0),
+  node_count_       (0),
+  solution_count_   (0),
+  placement_count_  (0),
+  cancelled_        (0),
+  propagation_      (false),
+  parity_pruning_   (false),
+  stopped_          (false)
+{
+  // The checkerboard coloring, and the middle layer along each axis.
+  for (int x = 0; x < Cube::N; ++x)
+    for (int y = 0; y < Cube::N; ++y)
+      for (int z = 0; z < Cube::N; ++z)
+      {
+        colorings_[0].put(x, y, z, (x + y + z) % 2 != 0);
+        colorings_[1].put(x, y, z, x % 2 != 0);
+        colorings_[2].put(x, y, z, y % 2 != 0);
+        colorings_[3].put(x, y, z, z % 2 != 0);
+      }
+}
+
+PuzzleSolver::~PuzzleSolver()
+{
+  g_timer_destroy(timer_);
+}
+
+void PuzzleSolver::set_figure(Cube figure)
+{
+  figure_ = figure;
+}
+
+void PuzzleSolver::add_piece(Cube piece)
+{
+  g_return_if_fail(piece != Cube());
+
+  pieces_.push_back(align_cube_piece(piece));
+}
+
+void PuzzleSolver::clear_pieces()
+{
+  pieces_.clear();
+}
+
+void PuzzleSolver::load_soma_cube()
+{
+  figure_ = ~Cube();
+  pieces_.clear();
+
+  for (unsigned int i = 0; i < G_N_ELEMENTS(cube_piece_data); ++i)
+    pieces_.push_back(Cube(cube_piece_data[i]));
+}
+
+/*
+ * Request the search in progress to stop as soon as possible.  If no
+ * search is running, the request applies to the next one.  This is the
+ * only method which may be called from another thread.
+ */
+void PuzzleSolver::cancel()
+{
+  g_atomic_int_set(&cancelled_, 1);
+}
+
+/*
+ * Whether any piece shares its shape with an earlier piece.
+ */
+bool PuzzleSolver::has_twins() const
+{
+  return (std::count(twins_.begin(), twins_.end(), -1) != int(twins_.size()));
+}
+
+/*
+ * Report each solution in turn to on_solution().  Returns true if the
+ * search ran to completion, or false if it was stopped by on_solution(),
+ * by cancel() or by the time limit.
+ */
+bool PuzzleSolver::solve()
+{
+  if (start())
+    enumerate(0, Cube());
+
+  finish();
+
+  return !stopped_;
+}
+
+/*
+ * Count the solutions, without reporting them.  Returns -1 if the count
+ * was cut short by cancel() or by the time limit.  Afterwards, the index
+ * built in the process may be taken over with swap_index().
+ */
+int PuzzleSolver::count()
+{
+  int result = 0;
+
+  if (start())
+    result = recurse(0, Cube());
+
+  finish();
+
+  if (stopped_)
+  {
+    counts_.clear();
+    return -1;
+  }
+
+  return result;
+}
+
+/*
+ * Lockstep search over several figures at once, for count_batch().  All
+ * lanes walk the same columns, which hold every placement that fits into
+ * the figure of at least one of the lanes.  Each lane starts out with the
+ * cells outside of its figure marked as occupied, so that placements not
+ * fitting the figure drop out through the same test as those colliding
+ * with other pieces.  A row is descended into if it fits in any lane, and
+ * the lanes it does not fit in are masked off for the whole subtree.
+ *
+ * The lanes are those of a LaneMask, or eight of them in an AVX2 register
+ * if the CPU supports it.
+ */
+class BatchCounter
+{
+private:
+  PuzzleSolver&             solver_;
+  ColumnStore               placements_;
+  ColumnStore               columns_;  // placements fitting any lane
+  std::vector<unsigned int> anchors_;  // per anchor row, the lanes allowed
+  std::vector<int>          twins_;
+  std::vector<int>          symmetries_[PuzzleSolver::MAX_BATCH_SIZE];
+  PieceStore                chosen_;
+  LaneMask                  counts_;
+  int                       anchor_;
+  int                       n_cells_;
+  int                       width_;
+
+  // noncopyable
+  BatchCounter(const BatchCounter&);
+  BatchCounter& operator=(const BatchCounter&);
+
+  void recurse(int col, const LaneMask& cube, const LaneMask& active);
+  void keep_least_images(LaneMask::value_type* lanes, int n_lanes) const;
+
+#if SOMATO_HAVE_AVX2_DISPATCH
+  __attribute__((__target__("avx2")))
+  void recurse_avx2(int col, const __m256i& cube, const __m256i& active, __m256i& counts);
+  __attribute__((__target__("avx2")))
+  void search_avx2(const LaneMask::value_type* cube, const LaneMask::value_type* active,
+                   LaneMask::value_type* counts);
+#endif
+
+public:
+  explicit BatchCounter(PuzzleSolver& solver);
+
+  int  get_width() const { return width_; }
+  void count(const Cube* figures, int n_figures, int* counts);
+};
+
+BatchCounter::BatchCounter(PuzzleSolver& solver)
+:
+  solver_     (solver),
+  placements_ (solver.pieces_.size()),
+  columns_    (solver.pieces_.size()),
+  anchors_    (),
+  twins_      (),
+  chosen_     (solver.pieces_.size()),
+  counts_     (),
+  anchor_     (-1),
+  n_cells_    (0),
+  width_      ((have_avx2()) ? 8 : LaneMask::WIDTH)
+{
+  find_twins(solver.pieces_, twins_);
+  anchor_ = find_anchor(twins_);
+
+  for (unsigned int i = 0; i < placements_.size(); ++i)
+  {
+    PieceStore& store = placements_[i];
+
+    shuffle_cube_piece(solver.pieces_[i], ~Cube(), store);
+    std::sort(store.begin(), store.end(), Cube::SortPredicate());
+
+    n_cells_ += count_cells(solver.pieces_[i]);
+    solver_.placement_count_ += store.size();
+  }
+}
+
+void BatchCounter::count(const Cube* figures, int n_figures, int* counts)
+{
+  g_return_if_fail(n_figures > 0 && n_figures <= width_);
+
+  LaneMask::value_type cube[PuzzleSolver::MAX_BATCH_SIZE]   = { 0, };
+  LaneMask::value_type active[PuzzleSolver::MAX_BATCH_SIZE] = { 0, };
+
+  for (int lane = 0; lane < n_figures; ++lane)
+    if (count_cells(figures[lane]) == n_cells_)
+    {
+      cube[lane]   = (~figures[lane]).to_bits();
+      active[lane] = ~LaneMask::value_type(0);
+    }
+
+  // Drop the placements which fit none of the figures.
+  for (unsigned int i = 0; i < columns_.size(); ++i)
+  {
+    PieceStore& store = columns_[i];
+
+    store.clear();
+
+    for (PieceStore::const_iterator p = placements_[i].begin(); p != placements_[i].end(); ++p)
+    {
+      int lane = 0;
+
+      while (lane < n_figures && (active[lane] == 0 || (p->to_bits() & cube[lane]) != 0))
+        ++lane;
+
+      if (lane < n_figures)
+        store.push_back(*p);
+    }
+
+    if (store.empty())
+      return;
+
+    store.push_back(Cube());
+  }
+
+  if (anchor_ >= 0)
+  {
+    const PieceStore& anchor = columns_[anchor_];
+
+    anchors_.assign(width_ * anchor.size(), 0);
+
+    PieceStore store;
+
+    for (int lane = 0; lane < n_figures; ++lane)
+    {
+      const Cube figure = figures[lane];
+
+      if (active[lane] == 0)
+        continue;
+
+      // Apply the rotation filter of the figure to the anchor piece.
+      store.clear();
+      std::remove_copy_if(anchor.begin(), anchor.end() - 1, std::back_inserter(store),
+                          Util::DoesIntersect<Cube>(~figure));
+      filter_rotations(store, figure);
+
+      for (PieceStore::const_iterator p = store.begin(); p != store.end(); ++p)
+      {
+        const int row = std::lower_bound(anchor.begin(), anchor.end() - 1, *p,
+                                         Cube::SortPredicate()) - anchor.begin();
+
+        anchors_[width_ * row + lane] = ~LaneMask::value_type(0);
+      }
+    }
+  }
+  else
+    for (int lane = 0; lane < n_figures; ++lane)
+      find_symmetries(figures[lane], symmetries_[lane]);
+
+  LaneMask::value_type result[PuzzleSolver::MAX_BATCH_SIZE];
+
+#if SOMATO_HAVE_AVX2_DISPATCH
+  if (width_ == 8)
+    search_avx2(cube, active, result);
+  else
+#endif
+  {
+    counts_ = LaneMask();
+    recurse(0, LaneMask::load(cube), LaneMask::load(active));
+    counts_.store(result);
+  }
+
+  if (!solver_.stopped_)
+    std::copy(result, result + n_figures, counts);
+}
+
+void BatchCounter::recurse(int col, const LaneMask& cube, const LaneMask& active)
+{
+  if ((++solver_.node_count_ & (CHECK_INTERVAL - 1)) == 0 && solver_.check_limits())
+    return;
+
+  const int   last   = columns_.size() - 1;
+  const Cube* column = &columns_[col][0];
+  const Cube* first  = column;
+
+  // Place a piece only after its twin, as in PuzzleSolver::recurse().
+  if (twins_[col] >= 0)
+    first = std::upper_bound(first, first + columns_[col].size() - 1,
+                             chosen_[twins_[col]], Cube::SortPredicate());
+
+  for (const Cube* row = first; *row != Cube(); ++row)
+  {
+    const LaneMask cell (row->to_bits());
+    LaneMask       fit = active & LaneMask::disjoint(cell, cube);
+
+    if (col == anchor_)
+      fit &= LaneMask::load(&anchors_[LaneMask::WIDTH * (row - column)]);
+
+    if (fit.any())
+    {
+      chosen_[col] = *row;
+
+      if (col < last)
+      {
+        recurse(col + 1, cube | cell, fit);
+
+        if (solver_.stopped_)
+          return;
+      }
+      else if (anchor_ >= 0)
+        counts_ -= fit;
+      else
+      {
+        LaneMask::value_type lanes[LaneMask::WIDTH];
+
+        fit.store(lanes);
+        keep_least_images(lanes, LaneMask::WIDTH);
+        counts_ -= LaneMask::load(lanes);
+      }
+    }
+  }
+}
+
+/*
+ * Without an anchor, clear the lanes of the mask for whose figure the
+ * complete solution in chosen_ is not the least of its images.
+ */
+void BatchCounter::keep_least_images(LaneMask::value_type* lanes, int n_lanes) const
+{
+  for (int lane = 0; lane < n_lanes; ++lane)
+    if (lanes[lane] != 0 && !is_least_image(&chosen_[0], chosen_.size(), symmetries_[lane]))
+      lanes[lane] = 0;
+}
+
+#if SOMATO_HAVE_AVX2_DISPATCH
+/*
+ * Same as recurse(), but with eight lanes in an AVX2 register.  Compiled
+ * for AVX2 no matter what the rest of the code targets, and only called
+ * if the CPU supports it.  The lane counts are subtracted from counts.
+ */
+__attribute__((__target__("avx2")))
+void BatchCounter::recurse_avx2(int col, const __m256i& cube, const __m256i& active,
+                                __m256i& counts)
+{
+  if ((++solver_.node_count_ & (CHECK_INTERVAL - 1)) == 0 && solver_.check_limits())
+    return;
+
+  const __m256i zero   = _mm256_setzero_si256();
+  const int     last   = columns_.size() - 1;
+  const Cube*   column = &columns_[col][0];
+  const Cube*   first  = column;
+
+  if (twins_[col] >= 0)
+    first = std::upper_bound(first, first + columns_[col].size() - 1,
+                             chosen_[twins_[col]], Cube::SortPredicate());
+
+  for (const Cube* row = first; *row != Cube(); ++row)
+  {
+    const __m256i cell  = _mm256_set1_epi32(row->to_bits());
+    const __m256i empty = _mm256_cmpeq_epi32(_mm256_and_si256(cell, cube), zero);
+    __m256i       fit   = _mm256_and_si256(active, empty);
+
+    if (col == anchor_)
+    {
+      const unsigned int* lanes = &anchors_[8 * (row - column)];
+      fit = _mm256_and_si256(fit, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes)));
+    }
+
+    if (!_mm256_testz_si256(fit, fit))
+    {
+      chosen_[col] = *row;
+
+      if (col < last)
+      {
+        recurse_avx2(col + 1, _mm256_or_si256(cube, cell), fit, counts);
+
+        if (solver_.stopped_)
+          return;
+      }
+      else if (anchor_ >= 0)
+        counts = _mm256_sub_epi32(counts, fit);
+      else
+      {
+        LaneMask::value_type lanes[8];
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), fit);
+        keep_least_images(lanes, 8);
+        counts = _mm256_sub_epi32(counts, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes)));
+      }
+    }
+  }
+}
+
+__attribute__((__target__("avx2")))
+void BatchCounter::search_avx2(const LaneMask::value_type* cube, const LaneMask::value_type* active,
+                               LaneMask::value_type* counts)
+{
+  __m256i result = _mm256_setzero_si256();
+
+  recurse_avx2(0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(cube)),
+               _mm256_loadu_si256(reinterpret_cast<const __m256i*>(active)), result);
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(counts), result);
+}
+#endif /* SOMATO_HAVE_AVX2_DISPATCH */
+
+/*
+ * Count the solutions of many figures with the same pieces.  Unlike in
+ * count(), the subtree counts are not memoized, as the states of the lanes
+ * diverge.  This pays off nevertheless, since the lanes share the control
+ * flow of the search, which is what count() spends most of its time on.
+ * The counts are left at zero for the figures not covered if stopped.
+ */
+bool PuzzleSolver::count_batch(const Cube* figures, int n_figures, int* counts)
+{
+  g_return_val_if_fail(n_figures >= 0, false);
+  g_return_val_if_fail(n_figures == 0 || (figures != 0 && counts != 0), false);
+
+  std::fill(counts, counts + n_figures, 0);
+
+  if (reset() && !pieces_.empty())
+  {
+    BatchCounter counter (*this);
+
+    const int width = counter.get_width();
+
+    for (int i = 0; i < n_figures && !stopped_; i += width)
+      counter.count(figures + i, std::min(n_figures - i, width), counts + i);
+  }
+
+  finish();
+
+  return !stopped_;
+}
+
+/*
+ * Build the decision diagram of all solutions.  The search is the same
+ * as in count(), except that each subtree yields a diagram node instead
+ * of a number.  Returns false if stopped, leaving the diagram empty.
+ */
+bool PuzzleSolver::build_diagram(SolutionDiagram& diagram)
+{
+  guint32 root = SolutionDiagram::FALSE_NODE;
+
+  diagram.begin(pieces_.size());
+
+  if (start())
+    root = construct(0, Cube(), diagram);
+
+  finish();
+
+  // The memo holds node indices rather than counts.
+  counts_.clear();
+
+  if (stopped_)
+  {
+    diagram.clear();
+    return false;
+  }
+
+  diagram.end(root);
+
+  return true;
+}
+
+/*
+ * Take over the zero-terminated placement columns and subtree counts
+ * from the last successful count().  The solver is left without them.
+ * This is not supported for puzzles with pieces of the same shape.
+ */
+void PuzzleSolver::swap_index(ColumnStore& columns, SubtreeCountStore& counts)
+{
+  g_return_if_fail(!counts_.empty() && columns_.size() == counts_.size());
+  g_return_if_fail(!has_twins()); // the memo is incomplete
+
+  columns_.swap(columns);
+  counts_.swap(counts);
+
+  columns_.clear();
+  counts_.clear();
+}
+
+bool PuzzleSolver::on_solution(const Cube*, int)
+{
+  return true;
+}
+
+/*
+ * Clear the results and statistics of the last search, and start the
+ * clock.  Returns false if the search has been cancelled in advance.
+ */
+bool PuzzleSolver::reset()
+{
+  columns_.clear();
+  counts_.clear();
+  state_.clear();
+  fixed_.clear();
+  candidates_.clear();
+  twins_.clear();
+  memoize_.clear();
+  symmetries_.clear();
+
+  elapsed_         = 0.0;
+  node_count_      = 0;
+  solution_count_  = 0;
+  placement_count_ = 0;
+  stopped_         = false;
+
+  g_timer_start(timer_);
+
+  if (g_atomic_int_get(&cancelled_))
+  {
+    stopped_ = true;
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Set up the placement columns for a new search.  Returns false if the
+ * puzzle cannot possibly be solved.
+ */
+bool PuzzleSolver::start()
+{
+  const int n_pieces = pieces_.size();
+
+  if (!reset())
+    return false;
+
+  int n_cells = 0;
+
+  for (int i = 0; i < n_pieces; ++i)
+    n_cells += count_cells(pieces_[i]);
+
+  if (n_pieces == 0 || n_cells != count_cells(figure_))
+    return false;
+
+  columns_.resize(n_pieces);
+  counts_.resize(n_pieces);
+  state_.resize(n_pieces);
+
+  if (propagation_)
+    fixed_.resize(n_pieces * n_pieces);
+
+  find_twins(pieces_, twins_);
+  anchor_ = find_anchor(twins_);
+
+  for (int i = 0; i < n_pieces; ++i)
+  {
+    PieceStore& store = columns_[i];
+
+    shuffle_cube_piece(pieces_[i], figure_, store);
+    std::sort(store.begin(), store.end(), Cube::SortPredicate());
+
+    if (i == anchor_)
+      filter_rotations(store, figure_);
+  }
+
+  if (anchor_ >= 0)
+  {
+    const Cube common = std::accumulate(columns_[anchor_].begin(), columns_[anchor_].end(),
+                                        ~Cube(), Util::Intersect<Cube>());
+
+    if (common != Cube())
+      for (int i = 0; i < n_pieces; ++i)
+        if (i != anchor_)
+        {
+          columns_[i].erase(std::remove_if(columns_[i].begin(), columns_[i].end(),
+                                           Util::DoesIntersect<Cube>(common)),
+                            columns_[i].end());
+        }
+  }
+  else
+    find_symmetries(figure_, symmetries_);
+
+  // Add zero-termination.
+  for (int i = 0; i < n_pieces; ++i)
+  {
+    placement_count_ += columns_[i].size();
+    columns_[i].push_back(Cube());
+  }
+
+  candidates_.resize(n_pieces);
+
+  for (int i = 0; i < n_pieces; ++i)
+    candidates_[i].resize(columns_[i].size());
+
+  // Pieces of the same shape are interchangeable.  Each one only goes to
+  // placements greater than that of its twin, i.e. the last piece before
+  // it with the same shape, so that permutations of a solution are found
+  // only once.  The subtree counts of states after a twin but not after
+  // all of its twins depend on more than the occupied cells, thus they
+  // cannot be memoized.  Without an anchor, whether a solution counts
+  // depends on all of its placements, so nothing is memoized at all.
+  memoize_.assign(n_pieces, anchor_ >= 0);
+
+  for (int i = 0; i < n_pieces; ++i)
+    for (int k = twins_[i] + 1; k <= i && twins_[i] >= 0; ++k)
+      memoize_[k] = false;
+
+  if (parity_pruning_)
+    init_color_sums();
+
+  return true;
+}
+
+void PuzzleSolver::finish()
+{
+  elapsed_ = g_timer_elapsed(timer_, 0);
+
+  g_atomic_int_set(&cancelled_, 0);
+}
+
+/*
+ * Called every CHECK_INTERVAL nodes.  Returns true if the search should
+ * be abandoned.
+ */
+bool PuzzleSolver::check_limits()
+{
+  if (g_atomic_int_get(&cancelled_)
+      || (time_limit_ > 0.0 && g_timer_elapsed(timer_, 0) >= time_limit_))
+    stopped_ = true;
+
+  return stopped_;
+}
+
+/*
+ * Count the solutions reachable from the search state given by the column
+ * index and the mask of occupied cube cells.  The result is memoized per
+ * state, so that states arrived at through different paths are explored
+ * only once, and so that SolutionSet can later walk down to any solution
+ * without having to visit the solutions preceding it.
+ *
+ * Unrolling the search at compile time for seven pieces measured no
+ * faster.  The time goes into the row scans and the memo lookups, and
+ * the compiler already hoists the column indexing out of the loops.
+ */
+int PuzzleSolver::recurse(int col, Cube cube)
+{
+  SubtreeCountMap& counts = counts_[col];
+  SubtreeCountMap::iterator pos = counts.end();
+
+  if (memoize_[col])
+  {
+    pos = counts.lower_bound(cube);
+
+    if (pos != counts.end() && pos->first == cube)
+      return pos->second;
+  }
+
+  if ((++node_count_ & (CHECK_INTERVAL - 1)) == 0 && check_limits())
+    return 0;
+
+  const int last = columns_.size() - 1;
+  int count = 0;
+
+  // Dead ends are memoized as well, since SolutionSet needs the count of
+  // every subtree it may step over.  Forced placements cannot be applied
+  // here, as the memo key would then no longer identify the subproblem.
+  if ((!parity_pruning_ || check_colorings(col, cube))
+      && (!propagation_ || propagate(col, cube, 0)))
+  {
+    Cube *const candidates = &candidates_[col][0];
+    const int   n_fit      = (*scan_column_)(&columns_[col][0], columns_[col].size() - 1,
+                                             cube, candidates);
+    const int   first      = first_candidate(col, candidates, n_fit);
+
+    if (col < last)
+      for (int i = first; i < n_fit; ++i)
+      {
+        state_[col] = candidates[i];
+        count += recurse(col + 1, cube | candidates[i]);
+
+        if (stopped_)
+          return 0;
+      }
+    else if (anchor_ >= 0)
+      count = n_fit - first;
+    else
+      for (int i = first; i < n_fit; ++i)
+      {
+        state_[col] = candidates[i];
+        count += is_least_image(&state_[0], col + 1, symmetries_);
+      }
+  }
+
+  if (memoize_[col])
+    counts.insert(pos, SubtreeCountMap::value_type(cube, count));
+
+  return count;
+}
+
+/*
+ * Chain the candidates of the column along the low branches, in reverse
+ * so that the least placement ends up on top.  The states of a column
+ * which share the remaining subproblem are memoized as in recurse(), and
+ * the diagram merges the remaining duplicates.
+ */
+guint32 PuzzleSolver::construct(int col, Cube cube, SolutionDiagram& diagram)
+{
+  SubtreeCountMap& counts = counts_[col];
+  SubtreeCountMap::iterator pos = counts.end();
+
+  if (memoize_[col])
+  {
+    pos = counts.lower_bound(cube);
+
+    if (pos != counts.end() && pos->first == cube)
+      return pos->second;
+  }
+
+  if ((++node_count_ & (CHECK_INTERVAL - 1)) == 0 && check_limits())
+    return SolutionDiagram::FALSE_NODE;
+
+  const int last = columns_.size() - 1;
+  guint32   node = SolutionDiagram::FALSE_NODE;
+
+  if ((!parity_pruning_ || check_colorings(col, cube))
+      && (!propagation_ || propagate(col, cube, 0)))
+  {
+    Cube *const candidates = &candidates_[col][0];
+    const int   n_fit      = (*scan_column_)(&columns_[col][0], columns_[col].size() - 1,
+                                             cube, candidates);
+    const int   first      = first_candidate(col, candidates, n_fit);
+
+    for (int i = n_fit - 1; i >= first; --i)
+    {
+      guint32 hi = SolutionDiagram::TRUE_NODE;
+
+      if (col < last)
+      {
+        state_[col] = candidates[i];
+        hi = construct(col + 1, cube | candidates[i], diagram);
+
+        if (stopped_)
+          return SolutionDiagram::FALSE_NODE;
+      }
+      else if (anchor_ < 0)
+      {
+        state_[col] = candidates[i];
+
+        if (!is_least_image(&state_[0], col + 1, symmetries_))
+          hi = SolutionDiagram::FALSE_NODE;
+      }
+
+      node = diagram.make_node(col, candidates[i], node, hi);
+    }
+  }
+
+  if (memoize_[col])
+    counts.insert(pos, SubtreeCountMap::value_type(cube, node));
+
+  return node;
+}
+
+/*
+ * Skip the candidates which are not greater than the placement of the
+ * twin of the piece, if any.  The candidates are in ascending order.
+ */
+int PuzzleSolver::first_candidate(int col, const Cube* candidates, int n_fit) const
+{
+  const int twin = twins_[col];
+
+  if (twin < 0)
+    return 0;
+
+  return std::upper_bound(candidates, candidates + n_fit, state_[twin],
+                          Cube::SortPredicate()) - candidates;
+}
+
+/*
+ * Depth-first search for solutions, in the same order in which recurse()
+ * counts them, so that the n-th solution reported is also the one found
+ * at index n of the complete SolutionSet.  Returns false if the search
+ * has been stopped.
+ *
+ * With propagation enabled, each level owns a row of fixed_ which lists
+ * the placements forced ahead of their column.  A forced placement is the
+ * only candidate its column could still take, so fixing it early does
+ * not change the order in which solutions are found.
+ */
+bool PuzzleSolver::enumerate(int col, Cube cube)
+{
+  if ((++node_count_ & (CHECK_INTERVAL - 1)) == 0 && check_limits())
+    return false;
+
+  const int n_cols = columns_.size();
+  const int last   = n_cols - 1;
+
+  Cube* fixed = 0;
+
+  if (propagation_)
+    fixed = &fixed_[col * n_cols];
+
+  if (parity_pruning_)
+  {
+    // Pieces forced ahead of their column still count as remaining.
+    Cube pending = cube;
+
+    if (fixed)
+      for (int k = col; k < n_cols; ++k)
+        pending &= ~fixed[k];
+
+    if (!check_colorings(col, pending))
+      return true;
+  }
+
+  if (fixed)
+  {
+    if (!propagate(col, cube, fixed))
+      return true;
+
+    if (fixed[col] != Cube())
+    {
+      if (twins_[col] >= 0 && !Cube::SortPredicate()(state_[twins_[col]], fixed[col]))
+        return true;
+
+      state_[col] = fixed[col];
+
+      if (col < last)
+      {
+        std::copy(fixed, fixed + n_cols, fixed + n_cols);
+        return enumerate(col + 1, cube);
+      }
+
+      if (anchor_ < 0 && !is_least_image(&state_[0], n_cols, symmetries_))
+        return true;
+
+      ++solution_count_;
+      stopped_ = !on_solution(&state_[0], n_cols);
+
+      return !stopped_;
+    }
+  }
+
+  Cube *const candidates = &candidates_[col][0];
+  const int   n_fit      = (*scan_column_)(&columns_[col][0], columns_[col].size() - 1,
+                                           cube, candidates);
+
+  for (int i = first_candidate(col, candidates, n_fit); i < n_fit; ++i)
+  {
+    const Cube cell = candidates[i];
+
+    state_[col] = cell;
+
+    if (col < last)
+    {
+      if (fixed)
+        std::copy(fixed, fixed + n_cols, fixed + n_cols);
+
+      if (!enumerate(col + 1, cube | cell))
+        return false;
+    }
+    else if (anchor_ >= 0 || is_least_image(&state_[0], n_cols, symmetries_))
+    {
+      ++solution_count_;
+
+      if (!on_solution(&state_[0], n_cols))
+      {
+        stopped_ = true;
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/*
+ * Tabulate for each column the cell counts of each color that the pieces
+ * from that column on can cover together.  The counts a piece can cover
+ * depend on where it goes, which is why a set is needed rather than a
+ * plain sum.  It is computed from the last column backwards.
+ */
+void PuzzleSolver::init_color_sums()
+{
+  const int n_cols = columns_.size();
+
+  color_sums_.assign((n_cols + 1) * COLORING_COUNT, 0);
+
+  for (int k = 0; k < COLORING_COUNT; ++k)
+    color_sums_[n_cols * COLORING_COUNT + k] = 1;
+
+  for (int col = n_cols - 1; col >= 0; --col)
+    for (int k = 0; k < COLORING_COUNT; ++k)
+    {
+      guint32 counts = 0;
+
+      for (PieceStore::const_iterator row = columns_[col].begin(); *row != Cube(); ++row)
+        counts |= guint32(1) << count_cells(*row & colorings_[k]);
+
+      const guint32 tail = color_sums_[(col + 1) * COLORING_COUNT + k];
+      guint32       sums = 0;
+
+      for (int n = 0; counts != 0; ++n, counts >>= 1)
+        if ((counts & 1) != 0)
+          sums |= tail << n;
+
+      color_sums_[col * COLORING_COUNT + k] = sums;
+    }
+}
+
+/*
+ * Returns false if the pieces from column col on cannot cover the number
+ * of empty cells of each color, for any of the colorings.
+ */
+bool PuzzleSolver::check_colorings(int col, Cube cube) const
+{
+  const Cube     empty = figure_ & ~cube;
+  const guint32* sums  = &color_sums_[col * COLORING_COUNT];
+
+  for (int k = 0; k < COLORING_COUNT; ++k)
+    if (((sums[k] >> count_cells(empty & colorings_[k])) & 1) == 0)
+      return false;
+
+  return true;
+}
+
+/*
+ * Look ahead from the search state given by the column index and the mask
+ * of occupied cells.  Returns false if some remaining piece has no place
+ * to go, or if some empty cell of the figure cannot be covered anymore.
+ *
+ * If fixed is not null, it holds the placements already forced for the
+ * columns from col on.  Further placements are forced and added to cube
+ * until none is left which is either the only candidate of its column, or
+ * the only candidate covering some empty cell.
+ */
+bool PuzzleSolver::propagate(int col, Cube& cube, Cube* fixed)
+{
+  const int n_cols = columns_.size();
+
+  for (;;)
+  {
+    Cube once;   // cells covered by at least one candidate
+    Cube twice;  // cells covered by at least two candidates
+    bool forced = false;
+
+    for (int k = col; k < n_cols && !forced; ++k)
+    {
+      if (fixed && fixed[k] != Cube())
+        continue;
+
+      Cube first;
+      int  count = 0;
+
+      for (PieceStore::const_iterator row = columns_[k].begin(); *row != Cube(); ++row)
+      {
+        const Cube cell = *row;
+
+        if ((cell & cube) == Cube())
+        {
+          twice |= once & cell;
+          once  |= cell;
+
+          if (count++ == 0)
+            first = cell;
+        }
+      }
+
+      if (count == 0)
+        return false;
+
+      if (count == 1 && fixed)
+      {
+        fixed[k] = first;
+        cube |= first;
+        forced = true;
+      }
+    }
+
+    if (forced)
+      continue;
+
+    const Cube empty = figure_ & ~cube;
+
+    if ((empty & ~once) != Cube())
+      return false;
+
+    const Cube::Bits single = (empty & ~twice).to_bits();
+
+    if (!fixed || single == 0)
+      return true;
+
+    // Force the one placement which covers the lowest such cell.
+    const Cube target = Cube::from_bits(single & (~single + 1));
+
+    for (int k = col; k < n_cols && !forced; ++k)
+    {
+      if (fixed[k] != Cube())
+        continue;
+
+      for (PieceStore::const_iterator row = columns_[k].begin(); *row != Cube(); ++row)
+      {
+        const Cube cell = *row;
+
+        if ((cell & target) != Cube() && (cell & cube) == Cube())
+        {
+          fixed[k] = cell;
+          cube |= cell;
+          forced = true;
+          break;
+        }
+      }
+    }
+
+    g_return_val_if_fail(forced, false);
+  }
+}
+
+} // namespace Somato
+
+/*
+ * The C interface.  The handle is simply a solver object which passes
+ * solutions on to a callback function.
+ */
+struct _SomatoSolver : public Somato::PuzzleSolver
+{
+  SomatoSolutionFunc  func;
+  gpointer            user_data;
+
+  _SomatoSolver() : func (0), user_data (0) {}
+
+protected:
+  virtual bool on_solution(const Somato::Cube* pieces, int count);
+};
+
+bool _SomatoSolver::on_solution(const Somato::Cube* pieces, int count)
+{
+  guint32 cells[8 * sizeof(Somato::Cube::Bits)];
+
+  g_return_val_if_fail(count <= int(G_N_ELEMENTS(cells)), false);
+
+  for (int i = 0; i < count; ++i)
+    cells[i] = pieces[i].to_bits();
+
+  return (*func)(cells, count, user_data);
+}
+
+extern "C"
+{
+
+SomatoSolver* somato_solver_new(void)
+{
+  try
+  {
+    return new SomatoSolver();
+  }
+  catch (const std::exception& error)
+  {
+    g_critical("%s", error.what());
+  }
+  return 0;
+}
+
+void somato_solver_free(SomatoSolver* solver)
+{
+  delete solver;
+}
+
+void somato_solver_set_figure(SomatoSolver* solver, guint32 cells)
+{
+  g_return_if_fail(solver != 0);
+
+  solver->set_figure(Somato::Cube::from_bits(cells));
+}
+
+guint32 somato_solver_get_figure(const SomatoSolver* solver)
+{
+  g_return_val_if_fail(solver != 0, 0);
+
+  return solver->get_figure().to_bits();
+}
+
+void somato_solver_add_piece(SomatoSolver* solver, guint32 cells)
+{
+  g_return_if_fail(solver != 0);
+
+  try
+  {
+    solver->add_piece(Somato::Cube::from_bits(cells));
+  }
+  catch (const std::exception& error)
+  {
+    g_critical("%s", error.what());
+  }
+}
+
+void somato_solver_clear_pieces(SomatoSolver* solver)
+{
+  g_return_if_fail(solver != 0);
+
+  solver->clear_pieces();
+}
+
+void somato_solver_load_soma_cube(SomatoSolver* solver)
+{
+  g_return_if_fail(solver != 0);
+
+  try
+  {
+    solver->load_soma_cube();
+  }
+  catch (const std::exception& error)
+  {
+    g_critical("%s", error.what());
+  }
+}
+
+void somato_solver_set_time_limit(SomatoSolver* solver, double seconds)
+{
+  g_return_if_fail(solver != 0);
+
+  solver->set_time_limit(seconds);
+}
+
+void somato_solver_set_propagation(SomatoSolver* solver, gboolean enable)
+{
+  g_return_if_fail(solver != 0);
+
+  solver->set_propagation(enable != FALSE);
+}
+
+void somato_solver_set_parity_pruning(SomatoSolver* solver, gboolean enable)
+{
+  g_return_if_fail(solver != 0);
+
+  solver->set_parity_pruning(enable != FALSE);
+}
+
+gboolean somato_solver_solve(SomatoSolver* solver, SomatoSolutionFunc func, gpointer user_data)
+{
+  g_return_val_if_fail(solver != 0, FALSE);
+  g_return_val_if_fail(func != 0, FALSE);
+
+  solver->func      = func;
+  solver->user_data = user_data;
+
+  try
+  {
+    return solver->solve();
+  }
+  catch (const std::exception& error)
+  {
+    g_critical("%s", error.what());
+  }
+  return FALSE;
+}
+
+int somato_solver_count(SomatoSolver* solver)
+{
+  g_return_val_if_fail(solver != 0, -1);
+
+  try
+  {
+    return solver->count();
+  }
+  catch (const std::exception& error)
+  {
+    g_critical("%s", error.what());
+  }
+  return -1;
+}
+
+gboolean somato_solver_count_batch(SomatoSolver* solver, const guint32* figures,
+                                   int n_figures, int* counts)
+{
+  g_return_val_if_fail(solver != 0, FALSE);
+  g_return_val_if_fail(n_figures >= 0, FALSE);
+  g_return_val_if_fail(n_figures == 0 || (figures != 0 && counts != 0), FALSE);
+
+  try
+  {
+    std::vector<Cube> cubes;
+    cubes.reserve(n_figures);
+
+    for (int i = 0; i < n_figures; ++i)
+      cubes.push_back(Cube::from_bits(figures[i]));
+
+    return solver->count_batch((cubes.empty()) ? 0 : &cubes[0], n_figures, counts);
+  }
+  catch (const std::exception& error)
+  {
+    g_critical("%s", error.what());
+  }
+  return FALSE;
+}
+
+void somato_solver_cancel(SomatoSolver* solver)
+{
+  g_return_if_fail(solver != 0);
+
+  solver->cancel();
+}
+
+guint64 somato_solver_get_stat(const SomatoSolver* solver, SomatoSolverStat stat)
+{
+  g_return_val_if_fail(solver != 0, 0);
+
+  switch (stat)
+  {
+    case SOMATO_SOLVER_STAT_NODES:        return solver->get_node_count();
+    case SOMATO_SOLVER_STAT_SOLUTIONS:    return solver->get_solution_count();
+    case SOMATO_SOLVER_STAT_PLACEMENTS:   return solver->get_placement_count();
+    case SOMATO_SOLVER_STAT_MICROSECONDS: return guint64(solver->get_elapsed() * 1e6 + 0.5);
+  }
+
+  g_return_val_if_reached(0);
+}
+
+} // extern "C"
@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOMATO_SOLVER_H_INCLUDED
+#define SOMATO_SOLVER_H_INCLUDED
+
+#include "array.h"
+#include "cube.h"
+
+#include <glib.h>
+#include <map>
+#include <vector>
+
+#include <config.h>
+
+namespace Somato
+{
+
+class SolutionDiagram;
+
+#if SOMATO_USE_UNCHECKEDVECTOR
+typedef Util::UncheckedVector<Cube>       PieceStore;
+typedef Util::UncheckedVector<PieceStore> ColumnStore;
+#else
+typedef std::vector<Cube>                 PieceStore;
+typedef std::vector<PieceStore>           ColumnStore;
+#endif
+
+/*
+ * Number of solutions reachable from each search state of a column,
+ * keyed on the mask of cube cells already occupied at that point.
+ */
+typedef std::map<Cube, int, Cube::SortPredicate> SubtreeCountMap;
+typedef std::vector<SubtreeCountMap>              SubtreeCountStore;
+
+/*
+ * Unique representatives of the shapes equal to the argument up to rotation
+ * of the whole cube.  Pieces are equivalent under translation as well, but
+ * figures are not, since moving a figure may change its symmetries.  Puzzles
+ * made of equivalent figures and pieces have the same number of solutions.
+ */
+Cube canonical_figure(Cube figure);
+Cube canonical_piece(Cube piece);
+
+// Append each placement of the piece within the figure to the store.
+void find_placements(Cube piece, Cube figure, PieceStore& store);
+
+/*
+ * Solver for puzzles which ask to assemble a figure within the cube from
+ * a set of pieces.  All state is kept in the solver object itself, thus
+ * any number of solvers may be used concurrently from different threads.
+ * Apart from cancel(), methods must not be called while a search is in
+ * progress.
+ */
+class PuzzleSolver
+{
+  friend class BatchCounter;
+
+public:
+  PuzzleSolver();
+  virtual ~PuzzleSolver();
+
+  void set_figure(Cube figure);
+  Cube get_figure() const { return figure_; }
+
+  // Pieces may be given in any position; they are moved to the origin.
+  void add_piece(Cube piece);
+  void clear_pieces();
+  int  get_piece_count() const { return pieces_.size(); }
+
+  // Define the classic Soma cube puzzle.
+  void load_soma_cube();
+
+  void   set_time_limit(double seconds) { time_limit_ = seconds; }
+  double get_time_limit() const { return time_limit_; }
+
+  // Look ahead at every node for pieces and cells without candidates.
+  // solve() also places pieces early which have only one option left.
+  void set_propagation(bool enable) { propagation_ = enable; }
+  bool get_propagation() const { return propagation_; }
+
+  // Cut off search states in which the remaining pieces cannot cover the
+  // empty cells of each color, for a few 2-colorings of the cube.
+  void set_parity_pruning(bool enable) { parity_pruning_ = enable; }
+  bool get_parity_pruning() const { return parity_pruning_; }
+
+  bool solve();
+  int  count();
+  void cancel();
+
+  // Count the solutions for each of the figures, as count() would with
+  // the figure set, several at a time.  Returns false if stopped.
+  bool count_batch(const Cube* figures, int n_figures, int* counts);
+
+  // Most figures count_batch() takes on in one pass, if the CPU allows.
+  enum { MAX_BATCH_SIZE = 8 };
+
+  // Collect all solutions into a decision diagram, which supports the
+  // same queries as SolutionSet without the limit to seven pieces.
+  bool build_diagram(SolutionDiagram& diagram);
+
+  void swap_index(ColumnStore& columns, SubtreeCountStore& counts);
+
+  guint64 get_node_count()      const { return node_count_; }
+  guint64 get_solution_count()  const { return solution_count_; }
+  int     get_placement_count() const { return placement_count_; }
+  double  get_elapsed()         const { return elapsed_; }
+
+protected:
+  // Called by solve() for every solution found, with the placements of
+  // the pieces in the order they were added.  Return false to stop.
+  virtual bool on_solution(const Cube* pieces, int count);
+
+private:
+  // Number of colorings checked by the parity pruning.
+  enum { COLORING_COUNT = 4 };
+
+  // Bit n is set if a cell count of n is attainable.
+  typedef std::vector<guint32> CountSetStore;
+
+  PieceStore        pieces_;
+  ColumnStore       columns_;
+  SubtreeCountStore counts_;
+  PieceStore        state_;
+  PieceStore        fixed_;
+  ColumnStore       candidates_;
+  std::vector<int>  twins_;
+  std::vector<bool> memoize_;
+  std::vector<int>  symmetries_;
+  Cube              colorings_[COLORING_COUNT];
+  CountSetStore     color_sums_;
+  GTimer*           timer_;
+  int             (*scan_column_)(const Cube* rows, int n_rows, Cube cube, Cube* out);
+  Cube              figure_;
+  int               anchor_;
+  double            time_limit_;
+  double            elapsed_;
+  guint64           node_count_;
+  guint64           solution_count_;
+  int               placement_count_;
+  volatile gint     cancelled_;
+  bool              propagation_;
+  bool              parity_pruning_;
+  bool              stopped_;
+
+  // noncopyable
+  PuzzleSolver(const PuzzleSolver&);
+  PuzzleSolver& operator=(const PuzzleSolver&);
+
+  bool reset();
+  bool start();
+  void finish();
+  bool check_limits();
+
+  void init_color_sums();
+  bool check_colorings(int col, Cube cube) const;
+  bool propagate(int col, Cube& cube, Cube* fixed);
+  int  recurse(int col, Cube cube);
+  guint32 construct(int col, Cube cube, SolutionDiagram& diagram);
+  int  first_candidate(int col, const Cube* candidates, int n_fit) const;
+  bool enumerate(int col, Cube cube);
+  bool has_twins() const;
+};
+
+} // namespace Somato
+
+#endif /* SOMATO_SOLVER_H_INCLUDED */
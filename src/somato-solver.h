@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2004-2008  Daniel Elstner  <daniel.kitta@gmail.com>
+ *
+ * This file is part of Somato.
+ *
+ * Somato is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * Somato is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Somato; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef SOMATO_SOMATO_SOLVER_H_INCLUDED
+#define SOMATO_SOMATO_SOLVER_H_INCLUDED
+
+/*
+ * C interface to the puzzle solver of libsomato-solver.
+ *
+ * Sets of cube cells are passed as bit masks, where bit 9x + 3y + z stands
+ * for cell (x, y, z) of the 3x3x3 grid.  Each solver handle is independent
+ * of all others, and only somato_solver_cancel() may be called on a handle
+ * while another thread is running a search on it.
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SomatoSolver SomatoSolver;
+
+typedef enum
+{
+  SOMATO_SOLVER_STAT_NODES,         /* search nodes expanded */
+  SOMATO_SOLVER_STAT_SOLUTIONS,     /* solutions reported */
+  SOMATO_SOLVER_STAT_PLACEMENTS,    /* piece placements considered */
+  SOMATO_SOLVER_STAT_MICROSECONDS   /* duration of the last search */
+} SomatoSolverStat;
+
+/*
+ * Receives the placement of each piece, in the order the pieces were added.
+ * Return FALSE to stop the search.
+ */
+typedef gboolean (*SomatoSolutionFunc) (const guint32 *pieces,
+                                        int            n_pieces,
+                                        gpointer       user_data);
+
+SomatoSolver* somato_solver_new            (void);
+void          somato_solver_free           (SomatoSolver       *solver);
+
+void          somato_solver_set_figure     (SomatoSolver       *solver,
+                                            guint32             cells);
+guint32       somato_solver_get_figure     (const SomatoSolver *solver);
+void          somato_solver_add_piece      (SomatoSolver       *solver,
+                                            guint32             cells);
+void          somato_solver_clear_pieces   (SomatoSolver       *solver);
+void          somato_solver_load_soma_cube (SomatoSolver       *solver);
+
+void          somato_solver_set_time_limit (SomatoSolver       *solver,
+                                            double              seconds);
+void          somato_solver_set_propagation(SomatoSolver       *solver,
+                                            gboolean            enable);
+void          somato_solver_set_parity_pruning (SomatoSolver *solver,
+                                                gboolean      enable);
+
+/* Returns TRUE if the search ran to completion. */
+gboolean      somato_solver_solve          (SomatoSolver       *solver,
+                                            SomatoSolutionFunc  func,
+                                            gpointer            user_data);
+
+/* Returns the number of solutions, or -1 if the count was cut short. */
+int           somato_solver_count          (SomatoSolver       *solver);
+
+/*
+ * Count the solutions for each of n_figures figures with the same pieces,
+ * several figures at a time.  Returns TRUE if all counts are complete.
+ */
+gboolean      somato_solver_count_batch    (SomatoSolver       *solver,
+                                            const guint32      *figures,
+                                            int                 n_figures,
+                                            int                *counts);
+
+/* Safe to call from any thread. */
+void          somato_solver_cancel         (SomatoSolver       *solver);
+
+guint64       somato_solver_get_stat       (const SomatoSolver *solver,
+                                            SomatoSolverStat    stat);
+
+G_END_DECLS
+
+#endif /* SOMATO_SOMATO_SOLVER_H_INCLUDED */
@@ -27,14 +27,17 @@
 
 #include <glib.h>
 #include <cmath>
+#include <cstring>
 #include <algorithm>
-#include <memory>
+#include <new>
 
 namespace
 {
 
 using Math::Matrix4;
 using Math::Vector4;
+using Somato::CubeElement;
+using Somato::CubeElementArray;
 
 typedef unsigned int EdgeType;
 typedef unsigned int EdgeFlags;
@@ -93,14 +96,15 @@ struct EdgeCorner
 {
   Vector4     vertex;
   EdgeCorner* link[3];
+  EdgeCorner* next;     // next corner at the same vertex
   EdgeFlags   flags;
 
-  static EdgeCorner* insert_unique(CornerStore& store, const Vector4& vertex, EdgeFlags flags);
-
   void add_link(EdgeCorner* node);
   void remove_link(EdgeCorner* node);
 
 private:
+  friend class CornerArena;
+
   inline EdgeCorner(const Vector4& vertex_, EdgeFlags flags_);
 
   // noncopyable
@@ -108,21 +112,120 @@ private:
   EdgeCorner& operator=(const EdgeCorner&);
 };
 
-template <class T>
-class ScopeClearDynamic
+/*
+ * Hash table of the elements emitted for the current piece, which maps
+ * each element to its index in the element array.  The table itself only
+ * holds indices, and the elements are compared for equality just like
+ * std::find() would.  Hashing the components quantized to a fixed grid
+ * ensures that equal elements always land in the same bucket, even if
+ * their bit patterns differ as with positive and negative zero.
+ */
+class ElementIndexMap
 {
 private:
-  T& cont_;
+  class Hash;
+  class Equal;
+
+  Util::ProbeTable<int> slots_; // element index plus one, or 0 if unused
+
+  // noncopyable
+  ElementIndexMap(const ElementIndexMap&);
+  ElementIndexMap& operator=(const ElementIndexMap&);
 
 public:
-  explicit ScopeClearDynamic(T& cont) : cont_ (cont) {}
-  inline  ~ScopeClearDynamic();
+  ElementIndexMap() : slots_ (256) {}
+
+  void clear() { slots_.clear(); }
+
+  // Return the index of the element if it has been seen before.  Otherwise
+  // the element is taken to go at the end of the array, and the size of
+  // the array is returned.
+  int insert(const CubeElementArray& elements, const CubeElement& element);
+};
+
+/*
+ * Bump allocator for the corners of a run, which are all released at once
+ * when the run is done.  The memory blocks are kept for the next run.  As
+ * corners are plain data, they are not destroyed individually.
+ */
+class CornerArena
+{
+private:
+  enum { BLOCK_SIZE = 128 };
+
+  std::vector<void*>  blocks_;
+  unsigned int        block_; // index of the block in use
+  unsigned int        used_;  // number of corners taken from it
+
+  // noncopyable
+  CornerArena(const CornerArena&);
+  CornerArena& operator=(const CornerArena&);
+
+public:
+  CornerArena() : blocks_ (), block_ (0), used_ (0) {}
+  ~CornerArena();
+
+  EdgeCorner* create(const Vector4& vertex, EdgeFlags flags);
+  void clear() { block_ = 0; used_ = 0; }
+};
+
+/*
+ * Hash table of the corners of a run, keyed on the vertex position.  The
+ * vertices lie on a lattice at integer multiples of the edge radius, thus
+ * the hash is taken over the lattice coordinates.  All corners at the same
+ * vertex are chained together in the order of insertion.
+ */
+class CornerIndex
+{
+private:
+  struct Hash
+  {
+    unsigned int operator()(const Vector4& vertex) const;
+    unsigned int operator()(const EdgeCorner* node) const { return (*this)(node->vertex); }
+  };
+
+  struct Equal
+  {
+    bool operator()(const EdgeCorner* node, const Vector4& vertex) const
+      { return (node->vertex == vertex); }
+  };
+
+  Util::ProbeTable<EdgeCorner*> slots_; // first corner at each vertex
+
+  // noncopyable
+  CornerIndex(const CornerIndex&);
+  CornerIndex& operator=(const CornerIndex&);
+
+public:
+  CornerIndex() : slots_ (256) {}
+
+  void clear() { slots_.clear(); }
+
+  EdgeCorner* find(const Vector4& vertex) const
+    { return slots_[slots_.find_slot(vertex, Hash(), Equal())]; }
+  void insert(EdgeCorner* node);
+};
+
+/*
+ * Forget the corners of a run on leaving the scope, even by exception.
+ */
+class ScopeClearCorners
+{
+private:
+  CornerStore&  store_;
+  CornerIndex&  index_;
+  CornerArena&  arena_;
+
+public:
+  ScopeClearCorners(CornerStore& store, CornerIndex& index, CornerArena& arena)
+    : store_ (store), index_ (index), arena_ (arena) {}
+  inline ~ScopeClearCorners();
 };
 
 enum
 {
-  EDGE_SLICES = 3,
-  EDGE_SCALE  = 16  // denominator of the edge radius
+  DEFAULT_EDGE_SLICES = 3,
+  EDGE_SCALE          = 16  // denominator of the edge radius
 };
 
 static const float edgeradius = 1.0 / EDGE_SCALE;
@@ -148,95 +251,28 @@ static const EdgeFlags EF_EDGEEND  = 1 << 3;
 static const EdgeFlags EF_CONTINUE = 1 << 4;
 
 /*
- * I very much dislike using the preprocessor to define these constants.
- * Unfortunately GCC generates a (huge) runtime initializer for the static
- * arrays below if the numbers are properly defined as variables of type
- * const float or const double.  Interestingly enough, even so the compiler
- * never generates actual memory loads for the constants, but puts them as
- * immediate operands directly into the code.  Presumably the corresponding
- * optimization takes place only at the code generation stage later on, and
- * therefore does not take care of static array initializers.
+ * Unit vectors of the rounded edges and corners, for a given number of
+ * slices per quarter circle.  The corner octant is covered by the points
+ * (a, b, c) with a + b + c = slices, which are mapped onto the sphere by
+ * the sines of a, b and c times pi / (2 slices), and the edges are the
+ * arcs where the first coordinate is zero.  A corner slice consists of a
+ * strip for the z-turn and one for the y-turn, of 2 i + 3 and 2 (slices
+ * - i) + 1 vectors respectively.  Generating the tables takes much less
+ * time than a single run of the tesselator.
  */
-#define SINPI3 0.86602540378443864676372317 /* sin(PI / 3) = sqrt(3) / 2 */
-#define TANPI6 0.57735026918962576450914878 /* tan(PI / 6) = sqrt(3) / 3 */
-
-static
-const Vector4::array_type edgedata[EDGE_SLICES + 1] =
+struct EdgeTables
 {
-  {    0.0,    0.0,    1.0,    0.0 },
-  {    0.0,    0.5, SINPI3,    0.0 },
-  {    0.0, SINPI3,    0.5,    0.0 },
-  {    0.0,    1.0,    0.0,    0.0 }
-};
+  Vector4::array_type edge[Somato::MAX_EDGE_SLICES + 1];
+  Vector4::array_type corner[Somato::MAX_EDGE_SLICES][2 * Somato::MAX_EDGE_SLICES + 4];
+  Vector4::array_type bridge_y[Somato::MAX_EDGE_SLICES + 1];
+  Vector4::array_type bridge_z[Somato::MAX_EDGE_SLICES + 1];
+  int                 slices;
 
-static
-const Vector4::array_type cornerdata[EDGE_SLICES][2 * EDGE_SLICES + 4] =
-{ 
-  { // z-turn, slice 0
-    {    0.5,    0.0, SINPI3,    0.0 },
-    {    0.0,    0.0,    1.0,    0.0 },
-    {    0.0,    0.5, SINPI3,    0.0 },
-    // y-turn, slice 0
-    {    1.0,    0.0,    0.0,    0.0 },
-    { SINPI3,    0.5,    0.0,    0.0 },
-    { SINPI3,    0.0,    0.5,    0.0 },
-    { TANPI6, TANPI6, TANPI6,    0.0 },
-    {    0.5,    0.0, SINPI3,    0.0 },
-    {    0.0,    0.5, SINPI3,    0.0 },
-    {    0.0,    0.0,    1.0,    0.0 }
-  },
-  { // z-turn, slice 1
-    { SINPI3,    0.0,    0.5,    0.0 },
-    {    0.5,    0.0, SINPI3,    0.0 },
-    { TANPI6, TANPI6, TANPI6,    0.0 },
-    {    0.0,    0.5, SINPI3,    0.0 },
-    {    0.0, SINPI3,    0.5,    0.0 },
-    // y-turn, slice 1
-    { SINPI3,    0.5,    0.0,    0.0 },
-    {    0.5, SINPI3,    0.0,    0.0 },
-    { TANPI6, TANPI6, TANPI6,    0.0 },
-    {    0.0, SINPI3,    0.5,    0.0 },
-    {    0.0,    0.5, SINPI3,    0.0 }
-  },
-  { // z-turn, slice 2
-    {    1.0,    0.0,    0.0,    0.0 },
-    { SINPI3,    0.0,    0.5,    0.0 },
-    { SINPI3,    0.5,    0.0,    0.0 },
-    { TANPI6, TANPI6, TANPI6,    0.0 },
-    {    0.5, SINPI3,    0.0,    0.0 },
-    {    0.0, SINPI3,    0.5,    0.0 },
-    {    0.0,    1.0,    0.0,    0.0 },
-    // y-turn, slice 2
-    {    0.5, SINPI3,    0.0,    0.0 },
-    {    0.0,    1.0,    0.0,    0.0 },
-    {    0.0, SINPI3,    0.5,    0.0 }
-  }
-};
+  void generate(int count);
 
-static
-const Vector4::array_type normaldata_bridge_y[2 * EDGE_SLICES + 2] =
-{
-  {    -1.0,     0.0,     0.0,     0.0 },
-  {    -1.0,     0.0,     0.0,     0.0 },
-  { -SINPI3,     0.5,     0.0,     0.0 },
-  { -SINPI3,     0.5,     0.0,     0.0 },
-  {    -0.5,  SINPI3,     0.0,     0.0 },
-  {    -0.5,  SINPI3,     0.0,     0.0 },
-  {     0.0,     1.0,     0.0,     0.0 },
-  {     0.0,     1.0,     0.0,     0.0 }
-};
-
-static
-const Vector4::array_type normaldata_bridge_z[2 * EDGE_SLICES + 2] =
-{
-  {     0.0,     0.0,     1.0,     0.0 },
-  {     0.0,     0.0,     1.0,     0.0 },
-  {    -0.5,     0.0,  SINPI3,     0.0 },
-  {    -0.5,     0.0,  SINPI3,     0.0 },
-  { -SINPI3,     0.0,     0.5,     0.0 },
-  { -SINPI3,     0.0,     0.5,     0.0 },
-  {    -1.0,     0.0,     0.0,     0.0 },
-  {    -1.0,     0.0,     0.0,     0.0 }
+private:
+  void set_octant(Vector4::array_type& v, int a, int b, int c) const;
+  double quarter_sine(int k) const;
 };
 
 /*
@@ -269,6 +305,7 @@ inline
 EdgeCorner::EdgeCorner(const Vector4& vertex_, EdgeFlags flags_)
 :
   vertex  (vertex_),
+  next    (0),
   flags   (flags_)
 {
   link[0] = 0;
@@ -276,29 +313,6 @@ EdgeCorner::EdgeCorner(const Vector4& vertex_, EdgeFlags flags_)
   link[2] = 0;
 }
 
-// static
-EdgeCorner* EdgeCorner::insert_unique(CornerStore& store, const Vector4& vertex, EdgeFlags flags)
-{
-  for (CornerStore::const_iterator p = store.begin(); p != store.end(); ++p)
-  {
-    // XXX
-    if (((*p)->flags == 0 || (*p)->flags == EF_CONTINUE) && !(*p)->link[2] && (*p)->vertex == vertex)
-    {
-      if (flags == EF_CONTINUE) // XXX
-        (*p)->flags |= EF_CONTINUE;
-      else
-        g_return_val_if_fail(flags == 0, 0);
-      return *p;
-    }
-  }
-
-  std::auto_ptr<EdgeCorner> node (new EdgeCorner(vertex, flags));
-
-  store.push_back(node.get());
-
-  return node.release();
-}
-
 void EdgeCorner::add_link(EdgeCorner* node)
 {
   int index = 0;
@@ -328,11 +342,183 @@ void EdgeCorner::remove_link(EdgeCorner* node)
   link[2] = 0;
 }
 
-template <class T> inline
-ScopeClearDynamic<T>::~ScopeClearDynamic()
+CornerArena::~CornerArena()
+{
+  for (std::vector<void*>::const_iterator p = blocks_.begin(); p != blocks_.end(); ++p)
+    operator delete(*p);
+}
+
+EdgeCorner* CornerArena::create(const Vector4& vertex, EdgeFlags flags)
+{
+  if (used_ == BLOCK_SIZE)
+  {
+    ++block_;
+    used_ = 0;
+  }
+
+  if (block_ == blocks_.size())
+    blocks_.push_back(operator new(BLOCK_SIZE * sizeof(EdgeCorner)));
+
+  void *const memory = static_cast<EdgeCorner*>(blocks_[block_]) + used_++;
+
+  return new (memory) EdgeCorner(vertex, flags);
+}
+
+unsigned int CornerIndex::Hash::operator()(const Vector4& vertex) const
+{
+  unsigned int h = 0;
+
+  for (int i = 0; i < 3; ++i)
+  {
+    const int q = int(std::floor(vertex[i] * float(EDGE_SCALE) + 0.5f));
+    h = (h ^ unsigned(q)) * 16777619U;
+  }
+
+  return h ^ (h >> 15);
+}
+
+void CornerIndex::insert(EdgeCorner* node)
+{
+  const unsigned int slot = slots_.find_slot(node->vertex, Hash(), Equal());
+
+  if (EdgeCorner* last = slots_[slot])
+  {
+    while (last->next)
+      last = last->next;
+
+    last->next = node;
+  }
+  else
+    slots_.insert(slot, node, node->vertex, Hash());
+}
+
+inline
+ScopeClearCorners::~ScopeClearCorners()
+{
+  index_.clear();
+  store_.clear();
+  arena_.clear();
+}
+
+/*
+ * The table holds element indices, which the functors look up in the
+ * element array to get at the elements themselves.
+ */
+class ElementIndexMap::Hash
+{
+private:
+  const CubeElementArray& elements_;
+
+public:
+  explicit Hash(const CubeElementArray& elements) : elements_ (elements) {}
+
+  unsigned int operator()(const CubeElement& element) const;
+  unsigned int operator()(int slot) const { return (*this)(elements_[slot - 1]); }
+};
+
+class ElementIndexMap::Equal
+{
+private:
+  const CubeElementArray& elements_;
+
+public:
+  explicit Equal(const CubeElementArray& elements) : elements_ (elements) {}
+
+  bool operator()(int slot, const CubeElement& element) const
+    { return (elements_[slot - 1] == element); }
+};
+
+unsigned int ElementIndexMap::Hash::operator()(const CubeElement& element) const
+{
+  float values[8];
+  std::memcpy(values, &element, sizeof values);
+
+  unsigned int h = 0;
+
+  for (int i = 0; i < 8; ++i)
+  {
+    const int q = int(std::floor(values[i] * 4096.0f + 0.5f));
+    h = (h ^ unsigned(q)) * 16777619U;
+  }
+
+  return h ^ (h >> 15);
+}
+
+int ElementIndexMap::insert(const CubeElementArray& elements, const CubeElement& element)
+{
+  const Hash hash (elements);
+
+  const unsigned int slot = slots_.find_slot(element, hash, Equal(elements));
+
+  if (slots_[slot] != 0)
+    return slots_[slot] - 1;
+
+  slots_.insert(slot, int(elements.size() + 1), element, hash);
+
+  return elements.size();
+}
+
+/*
+ * The sines are taken of integer multiples of the angle, so that the ends
+ * of the arcs come out as exactly 0 and 1.
+ */
+double EdgeTables::quarter_sine(int k) const
 {
-  std::for_each(cont_.begin(), cont_.end(), Util::Delete<typename T::value_type>());
-  cont_.clear();
+  return std::sin(k * G_PI / (2 * slices));
+}
+
+void EdgeTables::set_octant(Vector4::array_type& v, int a, int b, int c) const
+{
+  const double x = quarter_sine(a);
+  const double y = quarter_sine(b);
+  const double z = quarter_sine(c);
+  const double r = std::sqrt(x * x + y * y + z * z);
+
+  v[0] = x / r;
+  v[1] = y / r;
+  v[2] = z / r;
+  v[3] = 0.0;
+}
+
+void EdgeTables::generate(int count)
+{
+  slices = count;
+
+  for (int i = 0; i <= slices; ++i)
+  {
+    set_octant(edge[i], 0, i, slices - i);
+
+    bridge_y[i][0] = -quarter_sine(slices - i);
+    bridge_y[i][1] = quarter_sine(i);
+    bridge_y[i][2] = 0.0;
+    bridge_y[i][3] = 0.0;
+
+    bridge_z[i][0] = -quarter_sine(i);
+    bridge_z[i][1] = 0.0;
+    bridge_z[i][2] = quarter_sine(slices - i);
+    bridge_z[i][3] = 0.0;
+  }
+
+  for (int i = 0; i < slices; ++i)
+  {
+    Vector4::array_type* v = corner[i];
+
+    // z-turn, alternating between the layers c = slices - 1 - i and c + 1
+    for (int k = 0; k <= i; ++k)
+    {
+      set_octant(*v++, i + 1 - k, k, slices - 1 - i);
+      set_octant(*v++, i - k, k, slices - i);
+    }
+    set_octant(*v++, 0, i + 1, slices - 1 - i);
+
+    // y-turn, alternating between the layers b = i and b + 1
+    for (int k = 0; k < slices - i; ++k)
+    {
+      set_octant(*v++, slices - i - k, i, k);
+      set_octant(*v++, slices - i - 1 - k, i + 1, k);
+    }
+    set_octant(*v++, 0, i, slices - i);
+  }
 }
 
 static inline
@@ -342,9 +528,9 @@ bool is_surface_cell(const Somato::Cube& cube, int x, int y, int z)
 }
 
 static
-Vector4 adjust_joint(int i, EdgeFlags flags)
+Vector4 adjust_joint(const Vector4::array_type& edge, EdgeFlags flags)
 {
-  Vector4 v (edgedata[i]);
+  Vector4 v (edge);
 
   if ((flags & EF_JOINYZ) != 0 && (flags & EF_BRIDGE) == 0)
   {
@@ -386,6 +572,106 @@ Matrix4 compute_edge_rotation(const Vector4& a, const Vector4& b)
   return Matrix4(dx, dy, dz, Vector4(Matrix4::identity[3]));
 }
 
+/*
+ * The orientations in which the tesselator builds the flat faces of each
+ * direction, in turn facing towards +z, +y, +x, -z, -y and -x.  The texture
+ * coordinates of a face are its x and y coordinates in this orientation.
+ */
+static
+const Matrix4::array_type face_rotations[Somato::CUBE_FACE_COUNT] =
+{
+  { { 1,  0,  0, 0}, { 0,  1,  0, 0}, { 0,  0,  1, 0}, {0, 0, 0, 1} },
+  { { 1,  0,  0, 0}, { 0,  0, -1, 0}, { 0,  1,  0, 0}, {0, 0, 0, 1} },
+  { { 0, -1,  0, 0}, { 0,  0, -1, 0}, { 1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0, -1,  0, 0}, {-1,  0,  0, 0}, { 0,  0, -1, 0}, {0, 0, 0, 1} },
+  { { 0,  0,  1, 0}, {-1,  0,  0, 0}, { 0, -1,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0,  1, 0}, { 0,  1,  0, 0}, {-1,  0,  0, 0}, {0, 0, 0, 1} },
+};
+
+/*
+ * The orientations of a piece, in the order in which find_piece_pose()
+ * visits them.  Each matrix takes the geometry of the rotated piece back
+ * to the original orientation, in the same way as the tesselator's own
+ * transformation matrix.
+ */
+static
+const Matrix4::array_type pose_rotations[24] =
+{
+  { { 1,  0,  0, 0}, { 0,  1,  0, 0}, { 0,  0,  1, 0}, {0, 0, 0, 1} },
+  { { 0,  1,  0, 0}, {-1,  0,  0, 0}, { 0,  0,  1, 0}, {0, 0, 0, 1} },
+  { {-1,  0,  0, 0}, { 0, -1,  0, 0}, { 0,  0,  1, 0}, {0, 0, 0, 1} },
+  { { 0, -1,  0, 0}, { 1,  0,  0, 0}, { 0,  0,  1, 0}, {0, 0, 0, 1} },
+  { { 1,  0,  0, 0}, { 0,  0, -1, 0}, { 0,  1,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0, -1, 0}, {-1,  0,  0, 0}, { 0,  1,  0, 0}, {0, 0, 0, 1} },
+  { {-1,  0,  0, 0}, { 0,  0,  1, 0}, { 0,  1,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0,  1, 0}, { 1,  0,  0, 0}, { 0,  1,  0, 0}, {0, 0, 0, 1} },
+  { { 0, -1,  0, 0}, { 0,  0, -1, 0}, { 1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0, -1, 0}, { 0,  1,  0, 0}, { 1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  1,  0, 0}, { 0,  0,  1, 0}, { 1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0,  1, 0}, { 0, -1,  0, 0}, { 1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0, -1,  0, 0}, {-1,  0,  0, 0}, { 0,  0, -1, 0}, {0, 0, 0, 1} },
+  { {-1,  0,  0, 0}, { 0,  1,  0, 0}, { 0,  0, -1, 0}, {0, 0, 0, 1} },
+  { { 0,  1,  0, 0}, { 1,  0,  0, 0}, { 0,  0, -1, 0}, {0, 0, 0, 1} },
+  { { 1,  0,  0, 0}, { 0, -1,  0, 0}, { 0,  0, -1, 0}, {0, 0, 0, 1} },
+  { { 0,  0,  1, 0}, {-1,  0,  0, 0}, { 0, -1,  0, 0}, {0, 0, 0, 1} },
+  { {-1,  0,  0, 0}, { 0,  0, -1, 0}, { 0, -1,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0, -1, 0}, { 1,  0,  0, 0}, { 0, -1,  0, 0}, {0, 0, 0, 1} },
+  { { 1,  0,  0, 0}, { 0,  0,  1, 0}, { 0, -1,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0,  1, 0}, { 0,  1,  0, 0}, {-1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  1,  0, 0}, { 0,  0, -1, 0}, {-1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0,  0, -1, 0}, { 0, -1,  0, 0}, {-1,  0,  0, 0}, {0, 0, 0, 1} },
+  { { 0, -1,  0, 0}, { 0,  0,  1, 0}, {-1,  0,  0, 0}, {0, 0, 0, 1} },
+};
+
+enum { MODEL_CACHE_SIZE = 32 }; // LRU size the reordering optimizes for
+
+static inline
+GLshort pack_fixed(float value)
+{
+  const int i = int(std::floor(value * Somato::PACKED_ELEMENT_UNIT + 0.5f));
+
+  return std::max(-G_MAXSHORT, std::min(i, int(G_MAXSHORT)));
+}
+
+/*
+ * OpenGL maps a normal component byte c to (2c + 1) / 255, which hits
+ * both -1 and 1 exactly but not 0.
+ */
+static inline
+GLbyte pack_normal(float value)
+{
+  const int i = int(std::floor((255.0f * value - 1.0f) / 2.0f + 0.5f));
+
+  return std::max(-128, std::min(i, 127));
+}
+
+/*
+ * Score of a vertex by the heuristic of Tom Forsyth's linear-speed vertex
+ * cache optimization.  Vertices of the last triangle get a fixed score,
+ * so that the next triangle does not simply continue a thin strip, and the
+ * score of the others falls off with their age in the modelled cache.
+ * Vertices with few triangles left are favored, so as to finish them off
+ * rather than leave lone triangles behind.
+ */
+static
+float vertex_cache_score(int position, int remaining)
+{
+  if (remaining == 0)
+    return -1.0f;
+
+  float score = 0.0f;
+
+  if (position >= 0)
+  {
+    if (position < 3)
+      score = 0.75f;
+    else
+      score = std::pow(1.0f - float(position - 3) / (MODEL_CACHE_SIZE - 3), 1.5f);
+  }
+
+  return score + 2.0f / std::sqrt(float(remaining));
+}
+
 } // anonymous namespace
 
 namespace Somato
@@ -394,14 +680,22 @@ namespace Somato
 class CubeTesselator::Impl
 {
 private:
-  Matrix4     matrix_;
-  EdgeStore   edgestore_;
-  CornerStore cornerstore_;
-  EdgeCorner* lastcorner_;
-  Cube        piece_;
-  Cube        edgesdone_;
-  int         first_element_;
-  int         strip_index_;
+  Matrix4         matrix_;
+  EdgeStore       edgestore_;
+  CornerStore     cornerstore_;
+  FaceStore       vertexscratch_;   // scratch stores, which keep their
+  IndexStore      inwardscratch_;   // capacity from one run to the next
+  IndexStore      pairscratch_;
+  CornerStore     stripescratch_;
+  CornerIndex     cornerindex_;
+  CornerArena     cornerarena_;
+  EdgeCorner*     lastcorner_;
+  Cube            piece_;
+  Cube            edgesdone_;
+  ElementIndexMap element_index_;
+  EdgeTables      edgetables_;
+  int             strip_index_;
+  int             face_ends_[CUBE_FACE_COUNT];
 
   void begin_strip();
   void end_strip();
@@ -431,6 +725,7 @@ private:
   void check_new_edge(const CubePosition& pos, const CubePosition& ivertex,
                       EdgeType type, EdgeType prevtype);
   Vector4 vertex_at_corner(const CubePosition& vpos) const;
+  EdgeCorner* insert_unique_corner(const Vector4& vertex, EdgeFlags flags);
   EdgeFlags get_join_type_start(const CubePosition& pos, EdgeType type) const;
   EdgeFlags get_join_type_end(const CubePosition& pos, EdgeType type) const;
 
@@ -460,6 +755,11 @@ public:
   Impl();
   ~Impl();
 
+  void set_edge_slices(int value);
+  int get_edge_slices() const { return edgetables_.slices; }
+
+  int get_face_end(int face) const { return face_ends_[face]; }
+
   void run(Cube piece);
 };
 
@@ -526,6 +826,18 @@ float CubeTesselator::get_cellsize() const
   return pimpl_->cellsize;
 }
 
+void CubeTesselator::set_edge_slices(int value)
+{
+  g_return_if_fail(value >= 1 && value <= MAX_EDGE_SLICES);
+
+  pimpl_->set_edge_slices(value);
+}
+
+int CubeTesselator::get_edge_slices() const
+{
+  return pimpl_->get_edge_slices();
+}
+
 int CubeTesselator::reset_triangle_count()
 {
   const int value = pimpl_->trianglecount;
@@ -538,6 +850,13 @@ int CubeTesselator::get_triangle_count() const
   return pimpl_->trianglecount;
 }
 
+int CubeTesselator::get_face_end(int face) const
+{
+  g_return_val_if_fail(face >= 0 && face < CUBE_FACE_COUNT, 0);
+
+  return pimpl_->get_face_end(face);
+}
+
 void CubeTesselator::run(Cube piece)
 {
   pimpl_->run(piece);
@@ -548,10 +867,17 @@ CubeTesselator::Impl::Impl()
   matrix_           (),
   edgestore_        (),
   cornerstore_      (),
+  vertexscratch_    (),
+  inwardscratch_    (),
+  pairscratch_      (),
+  stripescratch_    (),
+  cornerindex_      (),
+  cornerarena_      (),
   lastcorner_       (0),
   piece_            (),
   edgesdone_        (),
-  first_element_    (0),
+  element_index_    (),
+  edgetables_       (),
   strip_index_      (0),
   element_array     (0),
   range_start_array (0),
@@ -559,40 +885,48 @@ CubeTesselator::Impl::Impl()
   index_array       (0),
   cellsize          (1.0),
   trianglecount     (0)
-{}
+{
+  std::fill(face_ends_, face_ends_ + CUBE_FACE_COUNT, 0);
+
+  edgetables_.generate(DEFAULT_EDGE_SLICES);
+}
 
 CubeTesselator::Impl::~Impl()
 {}
 
-void CubeTesselator::Impl::run(Cube piece)
+void CubeTesselator::Impl::set_edge_slices(int value)
 {
-  static const Matrix4::array_type rotate90[2] =
-  {
-    { {1, 0,  0, 0}, {0, 0, -1, 0}, {0, 1, 0, 0}, {0, 0, 0, 1} },  // 90 deg around x
-    { {0, 0, -1, 0}, {0, 1,  0, 0}, {1, 0, 0, 0}, {0, 0, 0, 1} }   // 90 deg around y
-  };
+  if (value != edgetables_.slices)
+    edgetables_.generate(value);
+}
 
+void CubeTesselator::Impl::run(Cube piece)
+{
   g_return_if_fail(element_array != 0);
   g_return_if_fail((range_start_array != 0) == (range_count_array != 0));
   g_return_if_fail((index_array != 0) != (range_start_array != 0));
   g_return_if_fail(range_start_array == 0 || range_start_array->size() == range_count_array->size());
 
   piece_         = piece;
-  first_element_ = element_array->size();
-  matrix_        = Matrix4::identity;
   lastcorner_    = 0;
 
-  ScopeClearDynamic<CornerStore> cornerscope (cornerstore_);
+  // Elements are only shared within the piece.
+  element_index_.clear();
+
+  ScopeClearCorners cornerscope (cornerstore_, cornerindex_, cornerarena_);
 
   for (unsigned int i = 0;; ++i)
   {
+    matrix_ = face_rotations[i];
+
     build_plane();
 
-    if (i == 5)
+    face_ends_[i] = (index_array) ? index_array->size() : range_start_array->size();
+
+    if (i == CUBE_FACE_COUNT - 1)
       break;
 
     piece_.rotate(i % 2);
-    matrix_ *= rotate90[i % 2];
   }
 
   trace_connected_edges();
@@ -626,18 +960,9 @@ void CubeTesselator::Impl::strip_element(const CubeElement& element)
 {
   if (index_array)
   {
-    const CubeElementArray::const_iterator pbegin = element_array->begin();
-    const CubeElementArray::const_iterator pend   = element_array->end();
-
-    // FIXME: The linear search below is horribly expensive and on the
-    // critical path.  The fix is to first come up with a proper data
-    // structure to describe the model surface, and then rewrite this
-    // horrible mess entirely from scratch.  Unfortunately I'm stuck at
-    // step one for now.
-    const CubeElementArray::const_iterator p = std::find(pbegin + first_element_, pend, element);
-    const int element_index = p - pbegin;
+    const int element_index = element_index_.insert(*element_array, element);
 
-    if (p == pend)
+    if (element_index == int(element_array->size()))
       element_array->push_back(element);
 
     if (strip_index_ > 2)
@@ -827,8 +1152,11 @@ void CubeTesselator::Impl::build_polygon(const CubePosition& start)
 
   g_return_if_fail(stair_count <= 1);
 
-  FaceStore   vertices;
-  IndexStore  inward;
+  FaceStore&  vertices = vertexscratch_;
+  IndexStore& inward   = inwardscratch_;
+
+  vertices.clear();
+  inward.clear();
 
   compute_contour_vertices(vertices, inward);
 
@@ -860,7 +1188,8 @@ void CubeTesselator::Impl::build_polygon(const CubePosition& start)
       {
         CubePosition pos = edgestore_[i].pos;
 
-        IndexStore indices;
+        IndexStore& indices = pairscratch_;
+        indices.clear();
 
         bool foo = false;
         if (i + 1 < edgestore_.size()
@@ -914,7 +1243,8 @@ void CubeTesselator::Impl::build_polygon(const CubePosition& start)
       {
         CubePosition pos = edgestore_[i].pos;
 
-        IndexStore indices;
+        IndexStore& indices = pairscratch_;
+        indices.clear();
 
         bool foo = false;
         if (i + 1 < edgestore_.size()
@@ -1065,7 +1395,7 @@ void CubeTesselator::Impl::build_contour_strip2(const FaceStore& vertices,
 //  g_return_if_fail(count >= 4 && count % 2 == 0);
   g_return_if_fail(count >= 4);
 
-  const Vector4 normal = matrix_ * edgedata[0];
+  const Vector4 normal = matrix_ * edgetables_.edge[0];
 
   {
     begin_strip();
@@ -1217,7 +1547,7 @@ void CubeTesselator::Impl::build_contour_strip(const FaceStore& vertices,
 
   g_return_if_fail(offset >= 0 && offset < n_vertices);
 
-  const Vector4 normal = matrix_ * edgedata[0];
+  const Vector4 normal = matrix_ * edgetables_.edge[0];
 
   {
     begin_strip();
@@ -1261,7 +1591,7 @@ void CubeTesselator::Impl::check_new_edge(const CubePosition& pos, const CubePos
       }
 
     g_return_if_fail(lastcorner_ != 0);
-    EdgeCorner *const cb = EdgeCorner::insert_unique(cornerstore_, vertex_at_corner(vpos), flags);
+    EdgeCorner *const cb = insert_unique_corner(vertex_at_corner(vpos), flags);
     EdgeCorner *const ca = lastcorner_;
     lastcorner_ = 0;
 
@@ -1283,7 +1613,7 @@ void CubeTesselator::Impl::check_new_edge(const CubePosition& pos, const CubePos
       }
 
     g_return_if_fail(lastcorner_ == 0);
-    lastcorner_ = EdgeCorner::insert_unique(cornerstore_, vertex_at_corner(vpos), flags);
+    lastcorner_ = insert_unique_corner(vertex_at_corner(vpos), flags);
   }
 }
 
@@ -1294,6 +1624,33 @@ Vector4 CubeTesselator::Impl::vertex_at_corner(const CubePosition& vpos) const
   return matrix_ * (vector * edgeradius);
 }
 
+/*
+ * Return the first corner at the vertex which is still open for another
+ * edge, or a new one if there is none.
+ */
+EdgeCorner* CubeTesselator::Impl::insert_unique_corner(const Vector4& vertex, EdgeFlags flags)
+{
+  for (EdgeCorner* p = cornerindex_.find(vertex); p != 0; p = p->next)
+  {
+    // XXX
+    if ((p->flags == 0 || p->flags == EF_CONTINUE) && !p->link[2])
+    {
+      if (flags == EF_CONTINUE) // XXX
+        p->flags |= EF_CONTINUE;
+      else
+        g_return_val_if_fail(flags == 0, 0);
+      return p;
+    }
+  }
+
+  EdgeCorner *const node = cornerarena_.create(vertex, flags);
+
+  cornerindex_.insert(node);
+  cornerstore_.push_back(node);
+
+  return node;
+}
+
 EdgeFlags CubeTesselator::Impl::get_join_type_start(const CubePosition& pos, EdgeType type) const
 {
   EdgeFlags result = 0;
@@ -1381,7 +1738,7 @@ void CubeTesselator::Impl::trace_connected_edges()
   }
 #endif
 
-  CornerStore stripe;
+  CornerStore& stripe = stripescratch_;
   stripe.reserve(cornerstore_.size());
 
   for (;;)
@@ -1603,17 +1960,17 @@ void CubeTesselator::Impl::build_single_edge(const Matrix4& rotation,
   {
     begin_strip();
 
-    for (int i = 0; i <= EDGE_SLICES; ++i)
+    for (int i = 0; i <= edgetables_.slices; ++i)
     {
-      const Vector4 normal = rotation * edgedata[i];
+      const Vector4 normal = rotation * edgetables_.edge[i];
       {
-        const Vector4 vector = rotation * adjust_joint(i, cb.flags | EF_EDGEEND);
+        const Vector4 vector = rotation * adjust_joint(edgetables_.edge[i], cb.flags | EF_EDGEEND);
         const Vector4 vertex = (cb.vertex + vector * edgeradius) * cellsize;
 
         strip_element(CubeElement(Vector4(edgetexcoord), normal, vertex));
       }
       {
-        const Vector4 vector = rotation * adjust_joint(i, ca.flags);
+        const Vector4 vector = rotation * adjust_joint(edgetables_.edge[i], ca.flags);
         const Vector4 vertex = (ca.vertex + vector * edgeradius) * cellsize;
 
         strip_element(CubeElement(Vector4(edgetexcoord), normal, vertex));
@@ -1634,18 +1991,20 @@ void CubeTesselator::Impl::build_edge_stripe2(const Matrix4& rotation,
     { {0, 0, 1, 0}, { 0, 1, 0, 0}, {-1, 0, 0, 0}, {0, 0, 0, 1} }   // 270 deg around y
   };
 
-  for (int i = 0; i < EDGE_SLICES; ++i)
+  const int slices = edgetables_.slices;
+
+  for (int i = 0; i < slices; ++i)
   {
     matrix_ = rotation;
 
     {
       begin_strip();
 
-      build_corner_slice(ca.vertex, cornerdata[i], 2 * i + 3, G_N_ELEMENTS(cornerdata[i]));
+      build_corner_slice(ca.vertex, edgetables_.corner[i], 2 * i + 3, 2 * slices + 4);
 
       matrix_ *= turnmatrices[0];
 
-      build_corner_slice(cb.vertex, cornerdata[i], 0, 2 * i + 3);
+      build_corner_slice(cb.vertex, edgetables_.corner[i], 0, 2 * i + 3);
 
       end_strip();
     }
@@ -1661,7 +2020,9 @@ void CubeTesselator::Impl::build_edge_stripe(const Matrix4& rotation, const Corn
     { {0, 0, 1, 0}, { 0, 1, 0, 0}, {-1, 0, 0, 0}, {0, 0, 0, 1} }   // 270 deg around y
   };
 
-  for (int i = 0; i < EDGE_SLICES; ++i)
+  const int slices = edgetables_.slices;
+
+  for (int i = 0; i < slices; ++i)
   {
     matrix_ = rotation;
 
@@ -1680,10 +2041,10 @@ void CubeTesselator::Impl::build_edge_stripe(const Matrix4& rotation, const Corn
           matrix_ *= turnmatrices[odd];
 
           if (odd)
-            build_corner_slice(stripe[k]->vertex, cornerdata[i], 2 * i + 3,
-                               G_N_ELEMENTS(cornerdata[i]));
+            build_corner_slice(stripe[k]->vertex, edgetables_.corner[i], 2 * i + 3,
+                               2 * slices + 4);
           else
-            build_corner_slice(stripe[k]->vertex, cornerdata[i], 0, 2 * i + 3);
+            build_corner_slice(stripe[k]->vertex, edgetables_.corner[i], 0, 2 * i + 3);
         }
         else
         {
@@ -1715,15 +2076,15 @@ void CubeTesselator::Impl::terminate_edge_slice(const Vector4& origin, EdgeFlags
                                                 int a, int b)
 {
   {
-    const Vector4 normal = matrix_ * edgedata[a];
-    const Vector4 vector = matrix_ * adjust_joint(a, flags);
+    const Vector4 normal = matrix_ * edgetables_.edge[a];
+    const Vector4 vector = matrix_ * adjust_joint(edgetables_.edge[a], flags);
     const Vector4 vertex = (origin + vector * edgeradius) * cellsize;
 
     strip_element(CubeElement(Vector4(edgetexcoord), normal, vertex));
   }
   {
-    const Vector4 normal = matrix_ * edgedata[b];
-    const Vector4 vector = matrix_ * adjust_joint(b, flags);
+    const Vector4 normal = matrix_ * edgetables_.edge[b];
+    const Vector4 vector = matrix_ * adjust_joint(edgetables_.edge[b], flags);
     const Vector4 vertex = (origin + vector * edgeradius) * cellsize;
 
     strip_element(CubeElement(Vector4(edgetexcoord), normal, vertex));
@@ -1760,11 +2121,13 @@ void CubeTesselator::Impl::build_bridge(const Matrix4& rotation,
   switch (flags & EF_JOINYZ)
   {
     case EF_JOINY:
-      build_bridge_strip(rotation, rotation * matrix_y, origin, cb->vertex, normaldata_bridge_y);
+      build_bridge_strip(rotation, rotation * matrix_y, origin, cb->vertex,
+                         edgetables_.bridge_y);
       break;
 
     case EF_JOINZ:
-      build_bridge_strip(rotation, rotation * matrix_z, origin, cb->vertex, normaldata_bridge_z);
+      build_bridge_strip(rotation, rotation * matrix_z, origin, cb->vertex,
+                         edgetables_.bridge_z);
       break;
 
     default:
@@ -1779,18 +2142,18 @@ void CubeTesselator::Impl::build_bridge_strip(const Matrix4& matrixa, const Matr
   {
     begin_strip();
 
-    for (int i = 0; i <= EDGE_SLICES; ++i)
+    for (int i = 0; i <= edgetables_.slices; ++i)
     {
       {
-        const Vector4 normal = matrixa * normals[2 * i];
-        const Vector4 vector = matrixa * edgedata[i];
+        const Vector4 normal = matrixa * normals[i];
+        const Vector4 vector = matrixa * edgetables_.edge[i];
         const Vector4 vertex = (a + vector * edgeradius) * cellsize;
 
         strip_element(CubeElement(Vector4(edgetexcoord), normal, vertex));
       }
       {
-        const Vector4 normal = matrixa * normals[2 * i + 1];
-        const Vector4 vector = matrixb * edgedata[i];
+        const Vector4 normal = matrixa * normals[i];
+        const Vector4 vector = matrixb * edgetables_.edge[i];
         const Vector4 vertex = (b + vector * edgeradius) * cellsize;
 
         strip_element(CubeElement(Vector4(edgetexcoord), normal, vertex));
@@ -1801,4 +2164,565 @@ void CubeTesselator::Impl::build_bridge_strip(const Matrix4& matrixa, const Matr
   }
 }
 
+/*
+ * The orientations are walked through just like the solver computes the
+ * rotations of a piece.  The canonical pose is the least of them, moved
+ * as close to the (0, 0, 0) corner as it will go.  Cell coordinates run
+ * along the model axes, except that z points the opposite way.
+ */
+Cube find_piece_pose(Cube piece, PiecePose& pose)
+{
+  enum { N = Cube::N };
+
+  // The cells of the lowest layer along each axis.  Like the orientation
+  // table, this is specific to the N = 3 case.
+  static const Cube::Bits first_layer[3] =
+  {
+    Cube::Bits(0x0001FF), Cube::Bits(0x1C0E07), Cube::Bits(0x1249249)
+  };
+  static const unsigned char layer_shift[3] = { N * N, N, 1 };
+  static const int           axis_sign[3]   = { 1, 1, -1 };
+
+  g_return_val_if_fail(piece != Cube(), piece);
+
+  Cube::Bits best = 0;
+  int        best_shift[3] = { 0, 0, 0 };
+
+  for (unsigned int i = 0, index = 0;; ++i)
+  {
+    Cube temp = piece;
+
+    for (int k = 0; k < 4; ++k, ++index)
+    {
+      Cube::Bits bits = temp.to_bits();
+      int shift[3] = { 0, 0, 0 };
+
+      for (int axis = 0; axis < 3; ++axis)
+        for (; (bits & first_layer[axis]) == 0; ++shift[axis])
+          bits >>= layer_shift[axis];
+
+      if (index == 0 || bits < best)
+      {
+        best          = bits;
+        pose.rotation = index;
+        std::copy(shift, shift + 3, best_shift);
+      }
+
+      temp.rotate(Cube::AXIS_Z);
+    }
+
+    if (i == 5)
+      break;
+
+    piece.rotate(Cube::AXIS_X + i % 2);
+  }
+
+  // Shifting the rotated piece away from the corner also happens before
+  // the rotation is undone, so the offset has to be rotated as well.
+  const Matrix4::array_type& rotation = pose_rotations[pose.rotation];
+
+  for (int i = 0; i < 3; ++i)
+  {
+    int offset = 0;
+
+    for (int axis = 0; axis < 3; ++axis)
+      offset += int(rotation[axis][i]) * axis_sign[axis] * best_shift[axis];
+
+    pose.offset[i] = offset;
+  }
+
+  return Cube::from_bits(best);
+}
+
+Math::Matrix4 get_pose_matrix(const PiecePose& pose, float cellsize)
+{
+  g_return_val_if_fail(pose.rotation < G_N_ELEMENTS(pose_rotations), Matrix4());
+
+  Matrix4 matrix (pose_rotations[pose.rotation]);
+
+  for (int i = 0; i < 3; ++i)
+    matrix[3][i] = pose.offset[i] * cellsize;
+
+  return matrix;
+}
+
+/*
+ * The pose turns the faces of one direction into those of another, whose
+ * texture coordinates come from a different orientation.  The texture
+ * repeats with every cell, and the turns keep the cell boundaries in place,
+ * so what remains of the difference is a rotation or reflection in the
+ * texture plane.
+ */
+Math::Matrix4 get_pose_texture_matrix(const PiecePose& pose, int face)
+{
+  g_return_val_if_fail(pose.rotation < G_N_ELEMENTS(pose_rotations), Matrix4());
+  g_return_val_if_fail(face >= 0 && face < CUBE_FACE_COUNT, Matrix4());
+
+  const Matrix4 turned = Matrix4(pose_rotations[pose.rotation]) * Matrix4(face_rotations[face]);
+
+  for (int i = 0; i < CUBE_FACE_COUNT; ++i)
+  {
+    if (Vector4(turned[2]) == face_rotations[i][2])
+    {
+      Matrix4 matrix (face_rotations[i]);
+
+      matrix.transpose();
+
+      return matrix * turned;
+    }
+  }
+
+  g_return_val_if_reached(Matrix4());
+}
+
+void pack_elements(const CubeElementArray& elements, float cellsize,
+                   PackedElementArray& packed)
+{
+  g_return_if_fail(cellsize > 0.0f);
+
+  packed.reserve(packed.size() + elements.size());
+
+  for (CubeElementArray::const_iterator p = elements.begin(); p != elements.end(); ++p)
+  {
+    PackedElement e;
+
+    e.texcoord[0] = pack_fixed(p->data[0][0]);
+    e.texcoord[1] = pack_fixed(p->data[0][1]);
+    e.normal[0]   = pack_normal(p->data[0][2]);
+    e.normal[1]   = pack_normal(p->data[0][3]);
+    e.normal[2]   = pack_normal(p->data[1][0]);
+    e.vertex[0]   = pack_fixed(p->data[1][1] / cellsize);
+    e.vertex[1]   = pack_fixed(p->data[1][2] / cellsize);
+    e.vertex[2]   = pack_fixed(p->data[1][3] / cellsize);
+    e.padding0    = 0;
+    e.padding1    = 0;
+
+    packed.push_back(e);
+  }
+}
+
+int count_vertex_cache_misses(const CubeIndex* indices, int count, int cache_size)
+{
+  g_return_val_if_fail(cache_size > 0, 0);
+
+  std::vector<int> fifo (cache_size, -1);
+  int next   = 0;
+  int misses = 0;
+
+  for (int i = 0; i < count; ++i)
+    if (std::find(fifo.begin(), fifo.end(), int(indices[i])) == fifo.end())
+    {
+      fifo[next] = indices[i];
+      next = (next + 1) % cache_size;
+      ++misses;
+    }
+
+  return misses;
+}
+
+/*
+ * Greedily pick the triangle of highest score next, where the score of a
+ * triangle is the sum of the scores of its vertices.  Only the triangles
+ * of the vertices in the modelled cache change their scores after each
+ * step, thus the search for the best one is restricted to these, and the
+ * whole mesh is only scanned if none of them is left.
+ */
+void optimize_vertex_cache(CubeIndex* indices, int count)
+{
+  g_return_if_fail(count % 3 == 0);
+
+  const int triangle_count = count / 3;
+
+  if (triangle_count < 2)
+    return;
+
+  const std::vector<CubeIndex> source (indices, indices + count);
+  const int vertex_count = *std::max_element(source.begin(), source.end()) + 1;
+
+  // Lists of the triangles of each vertex, with the triangles not yet
+  // drawn kept in front of those already drawn.
+  std::vector<int> offsets (vertex_count + 1, 0);
+
+  for (int i = 0; i < count; ++i)
+    ++offsets[source[i] + 1];
+
+  for (int v = 0; v < vertex_count; ++v)
+    offsets[v + 1] += offsets[v];
+
+  std::vector<int> remaining (vertex_count, 0);
+  std::vector<int> adjacency (count);
+
+  for (int i = 0; i < count; ++i)
+  {
+    const int v = source[i];
+    adjacency[offsets[v] + remaining[v]++] = i / 3;
+  }
+
+  std::vector<int>   position (vertex_count, -1);
+  std::vector<float> vertex_score (vertex_count);
+
+  for (int v = 0; v < vertex_count; ++v)
+    vertex_score[v] = vertex_cache_score(-1, remaining[v]);
+
+  std::vector<float> triangle_score (triangle_count);
+  std::vector<char>  drawn (triangle_count, 0);
+
+  int best = 0;
+
+  for (int t = 0; t < triangle_count; ++t)
+  {
+    triangle_score[t] = vertex_score[source[3 * t]] + vertex_score[source[3 * t + 1]]
+                      + vertex_score[source[3 * t + 2]];
+
+    if (triangle_score[t] > triangle_score[best])
+      best = t;
+  }
+
+  int cache[MODEL_CACHE_SIZE + 3];
+  int cache_size = 0;
+
+  for (int n = 0; n < triangle_count; ++n)
+  {
+    if (best < 0)
+    {
+      float best_score = -1.0f;
+
+      for (int t = 0; t < triangle_count; ++t)
+        if (!drawn[t] && triangle_score[t] > best_score)
+        {
+          best_score = triangle_score[t];
+          best = t;
+        }
+    }
+
+    drawn[best] = 1;
+
+    const CubeIndex *const corners = &source[3 * best];
+    std::copy(corners, corners + 3, indices + 3 * n);
+
+    // The vertices of the triangle move to the front of the cache, and
+    // the others are pushed back behind them.
+    int updated[MODEL_CACHE_SIZE + 3];
+    int updated_size = 0;
+
+    for (int i = 0; i < 3; ++i)
+    {
+      const int v = corners[i];
+
+      int *const first = &adjacency[offsets[v]];
+      int *const last  = first + --remaining[v];
+
+      std::iter_swap(std::find(first, last, best), last);
+
+      if (std::find(updated, updated + updated_size, v) == updated + updated_size)
+        updated[updated_size++] = v;
+    }
+
+    for (int i = 0; i < cache_size; ++i)
+      if (std::find(updated, updated + updated_size, cache[i]) == updated + updated_size)
+        updated[updated_size++] = cache[i];
+
+    // Vertices which fall out of the cache are rescored once more.
+    for (int i = 0; i < updated_size; ++i)
+    {
+      const int v = updated[i];
+
+      position[v] = (i < MODEL_CACHE_SIZE) ? i : -1;
+      vertex_score[v] = vertex_cache_score(position[v], remaining[v]);
+    }
+
+    float best_score = -1.0f;
+    best = -1;
+
+    for (int i = 0; i < updated_size; ++i)
+    {
+      const int v = updated[i];
+
+      for (int k = offsets[v]; k < offsets[v] + remaining[v]; ++k)
+      {
+        const int t = adjacency[k];
+
+        triangle_score[t] = vertex_score[source[3 * t]] + vertex_score[source[3 * t + 1]]
+                          + vertex_score[source[3 * t + 2]];
+
+        if (triangle_score[t] > best_score)
+        {
+          best_score = triangle_score[t];
+          best = t;
+        }
+      }
+    }
+
+    cache_size = std::min(updated_size, int(MODEL_CACHE_SIZE));
+    std::copy(updated, updated + cache_size, cache);
+  }
+}
+
+struct TesselationCache::Job
+{
+  Cube  piece;
+  float cellsize;
+  int   edge_slices;
+  Entry entry;
+};
+
+TesselationCache::TesselationCache(unsigned int memory_limit)
+:
+  tesselator_       (),
+  element_scratch_  (),
+  index_scratch_    (),
+  entries_          (),
+  index_            (),
+  cellsize_         (1.0),
+  edge_slices_      (DEFAULT_EDGE_SLICES),
+  memory_limit_     (memory_limit),
+  memory_usage_     (0),
+  hit_count_        (0),
+  miss_count_       (0)
+{
+  tesselator_.set_element_array(&element_scratch_);
+  tesselator_.set_index_array(&index_scratch_);
+  tesselator_.set_cellsize(cellsize_);
+}
+
+TesselationCache::~TesselationCache()
+{}
+
+void TesselationCache::set_cellsize(float value)
+{
+  if (value != cellsize_)
+  {
+    clear();
+    cellsize_ = value;
+    tesselator_.set_cellsize(value);
+  }
+}
+
+void TesselationCache::set_edge_slices(int value)
+{
+  g_return_if_fail(value >= 1 && value <= MAX_EDGE_SLICES);
+
+  if (value != edge_slices_)
+  {
+    clear();
+    edge_slices_ = value;
+    tesselator_.set_edge_slices(value);
+  }
+}
+
+void TesselationCache::set_memory_limit(unsigned int bytes)
+{
+  memory_limit_ = bytes;
+  trim(memory_limit_);
+}
+
+void TesselationCache::clear()
+{
+  index_.clear();
+  entries_.clear();
+  memory_usage_ = 0;
+}
+
+/*
+ * Each job runs a tesselator of its own, which shares nothing with the
+ * others but the constant tables.  The finished entries are added to the
+ * cache by the calling thread alone.
+ */
+void TesselationCache::prefetch(const std::vector<Cube>& pieces, int n_threads)
+{
+  std::vector<Job> jobs;
+
+  for (std::vector<Cube>::const_iterator p = pieces.begin(); p != pieces.end(); ++p)
+  {
+    bool queued = (index_.find(*p) != index_.end());
+
+    for (unsigned int i = 0; i < jobs.size() && !queued; ++i)
+      queued = (jobs[i].piece == *p);
+
+    if (!queued)
+    {
+      jobs.push_back(Job());
+      jobs.back().piece       = *p;
+      jobs.back().cellsize    = cellsize_;
+      jobs.back().edge_slices = edge_slices_;
+    }
+  }
+
+  GThreadPool* pool = 0;
+
+  if (n_threads > 1 && jobs.size() > 1 && g_thread_supported())
+    pool = g_thread_pool_new(&TesselationCache::execute_job, 0,
+                             std::min(n_threads, int(jobs.size())), FALSE, 0);
+
+  for (unsigned int i = 0; i < jobs.size(); ++i)
+  {
+    if (pool)
+      g_thread_pool_push(pool, &jobs[i], 0);
+    else
+      execute_job(&jobs[i], 0);
+  }
+
+  if (pool)
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+  for (std::vector<Job>::iterator p = jobs.begin(); p != jobs.end(); ++p)
+  {
+    ++miss_count_;
+    insert(p->piece, p->entry);
+  }
+}
+
+// static
+void TesselationCache::execute_job(void* data, void*)
+{
+  Job& job = *static_cast<Job*>(data);
+
+  CubeTesselator   tesselator;
+  CubeElementArray elements;
+
+  tesselator.set_element_array(&elements);
+  tesselator.set_index_array(&job.entry.indices);
+  tesselator.set_cellsize(job.cellsize);
+  tesselator.set_edge_slices(job.edge_slices);
+
+  tesselator.run(job.piece);
+
+  for (int i = 0; i < CUBE_FACE_COUNT; ++i)
+    job.entry.face_ends[i] = tesselator.get_face_end(i);
+
+  job.entry.triangle_count = tesselator.reset_triangle_count();
+
+  pack_elements(elements, job.cellsize, job.entry.elements);
+
+  optimize_entry(job.entry);
+}
+
+int TesselationCache::append(Cube piece, PackedElementArray& elements, CubeIndexArray& indices,
+                             unsigned int* face_ends)
+{
+  const Entry& entry = lookup(piece)->second;
+  const unsigned int offset = elements.size();
+
+  // The offset indices have to fit into the 16 bits of CubeIndex.
+  g_return_val_if_fail(offset + entry.elements.size() <= G_MAXUSHORT + 1U, 0);
+
+  elements.insert(elements.end(), entry.elements.begin(), entry.elements.end());
+
+  for (CubeIndexArray::const_iterator p = entry.indices.begin(); p != entry.indices.end(); ++p)
+    indices.push_back(*p + offset);
+
+  std::copy(entry.face_ends, entry.face_ends + CUBE_FACE_COUNT, face_ends);
+
+  return entry.triangle_count;
+}
+
+// static
+unsigned int TesselationCache::entry_size(const Entry& entry)
+{
+  return sizeof(EntryList::value_type) + sizeof(EntryMap::value_type)
+       + entry.elements.size() * sizeof(PackedElement)
+       + entry.indices.size() * sizeof(CubeIndex);
+}
+
+/*
+ * Reorder the triangles of a new entry for the vertex cache, once and for
+ * all before the entry goes into the cache.  This is done by the thread
+ * which tesselated the piece.  The faces of each direction stay together, as they are drawn with
+ * texture matrices of their own.
+ */
+// static
+void TesselationCache::optimize_entry(Entry& entry)
+{
+  CubeIndex *const indices = (entry.indices.empty()) ? 0 : &entry.indices[0];
+  const int        count   = entry.indices.size();
+
+  int start = 0;
+
+  for (int i = 0; i <= CUBE_FACE_COUNT; ++i)
+  {
+    const int end = (i < CUBE_FACE_COUNT) ? entry.face_ends[i] : count;
+
+    if (end > start)
+      optimize_vertex_cache(indices + start, end - start);
+
+    start = end;
+  }
+}
+
+/*
+ * Find the entry of the piece and move it to the front, or tesselate the
+ * piece into a new entry there.
+ */
+TesselationCache::EntryList::iterator TesselationCache::lookup(Cube piece)
+{
+  const EntryMap::iterator pos = index_.find(piece);
+
+  if (pos != index_.end())
+  {
+    ++hit_count_;
+    entries_.splice(entries_.begin(), entries_, pos->second);
+    return pos->second;
+  }
+
+  ++miss_count_;
+
+  tesselator_.run(piece);
+
+  // Swapping leaves the index scratch array empty for the next run,
+  // while the element scratch array keeps its storage.
+  Entry entry;
+
+  pack_elements(element_scratch_, cellsize_, entry.elements);
+  element_scratch_.clear();
+
+  entry.indices.swap(index_scratch_);
+
+  for (int i = 0; i < CUBE_FACE_COUNT; ++i)
+    entry.face_ends[i] = tesselator_.get_face_end(i);
+
+  entry.triangle_count = tesselator_.reset_triangle_count();
+
+  optimize_entry(entry);
+
+  return insert(piece, entry);
+}
+
+/*
+ * Move the contents of the entry to a new entry at the front.  The new
+ * entry is always kept, even if it exceeds the memory limit on its own.
+ */
+TesselationCache::EntryList::iterator TesselationCache::insert(Cube piece, Entry& entry)
+{
+  const unsigned int size = entry_size(entry);
+
+  trim((memory_limit_ > size) ? memory_limit_ - size : 0);
+
+  entries_.push_front(EntryList::value_type(piece, Entry()));
+
+  Entry& front = entries_.front().second;
+
+  front.elements.swap(entry.elements);
+  front.indices.swap(entry.indices);
+  std::copy(entry.face_ends, entry.face_ends + CUBE_FACE_COUNT, front.face_ends);
+  front.triangle_count = entry.triangle_count;
+
+  index_.insert(EntryMap::value_type(piece, entries_.begin()));
+  memory_usage_ += size;
+
+  return entries_.begin();
+}
+
+/*
+ * Evict least recently used entries until the usage fits the limit.
+ */
+void TesselationCache::trim(unsigned int limit)
+{
+  while (memory_usage_ > limit && !entries_.empty())
+  {
+    memory_usage_ -= entry_size(entries_.back().second);
+    index_.erase(entries_.back().first);
+    entries_.pop_back();
+  }
+}
+
 } // namespace Somato
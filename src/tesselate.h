@@ -24,6 +24,8 @@
 #include "cube.h"
 #include "vectormath.h"
 
+#include <list>
+#include <map>
 #include <vector>
 #include <config.h>
 
@@ -37,22 +39,43 @@ namespace Somato
 typedef Math::Vector233 CubeElement;
 typedef GLushort        CubeIndex;
 
+/*
+ * Compact vertex format of the piece geometry in vertex buffers, at half
+ * the size of CubeElement.  Positions and texture coordinates are fixed
+ * point numbers with PACKED_ELEMENT_UNIT steps per cell, thus drawing
+ * requires the modelview and texture matrices to scale them back.  The
+ * normal bytes are mapped to [-1, 1] by OpenGL itself.
+ */
+struct PackedElement
+{
+  GLshort vertex[3];
+  GLshort padding0;
+  GLshort texcoord[2];
+  GLbyte  normal[3];
+  GLbyte  padding1;
+};
+
 #if SOMATO_USE_UNCHECKEDVECTOR
-typedef Util::UncheckedVector<CubeElement>  CubeElementArray;
-typedef Util::UncheckedVector<CubeIndex>    CubeIndexArray;
-typedef Util::UncheckedVector<GLint>        RangeStartArray;
-typedef Util::UncheckedVector<GLsizei>      RangeCountArray;
+typedef Util::UncheckedVector<CubeElement>    CubeElementArray;
+typedef Util::UncheckedVector<PackedElement>  PackedElementArray;
+typedef Util::UncheckedVector<CubeIndex>      CubeIndexArray;
+typedef Util::UncheckedVector<GLint>          RangeStartArray;
+typedef Util::UncheckedVector<GLsizei>        RangeCountArray;
 #else
-typedef std::vector<CubeElement>            CubeElementArray;
-typedef std::vector<CubeIndex>              CubeIndexArray;
-typedef std::vector<GLint>                  RangeStartArray;
-typedef std::vector<GLsizei>                RangeCountArray;
+typedef std::vector<CubeElement>              CubeElementArray;
+typedef std::vector<PackedElement>            PackedElementArray;
+typedef std::vector<CubeIndex>                CubeIndexArray;
+typedef std::vector<GLint>                    RangeStartArray;
+typedef std::vector<GLsizei>                  RangeCountArray;
 #endif /* !SOMATO_USE_UNCHECKEDVECTOR */
 
 enum
 {
-  CUBE_ELEMENT_TYPE = GL_T2F_N3F_V3F,
-  CUBE_INDEX_TYPE   = GL_UNSIGNED_SHORT
+  CUBE_ELEMENT_TYPE   = GL_T2F_N3F_V3F,
+  CUBE_INDEX_TYPE     = GL_UNSIGNED_SHORT,
+  PACKED_ELEMENT_UNIT = 8192, // fixed point steps per cell
+  MAX_EDGE_SLICES     = 8,    // limit of the rounded edges' level of detail
+  CUBE_FACE_COUNT     = 6     // directions of the flat faces of a piece
 };
 
 /*
@@ -77,9 +100,19 @@ public:
   void set_cellsize(float value);
   float get_cellsize() const;
 
+  // Number of slices per quarter circle of the rounded edges and corners,
+  // from 1 for a bevel up to MAX_EDGE_SLICES.  The default is 3.
+  void set_edge_slices(int value);
+  int get_edge_slices() const;
+
   int reset_triangle_count();
   int get_triangle_count() const;
 
+  // Size of the index array, or of the range arrays if strips are generated,
+  // after the flat faces of the given direction were added by the last run.
+  // The rounded edges and corners follow the faces of the last direction.
+  int get_face_end(int face) const;
+
   void run(Cube piece);
 
 private:
@@ -94,6 +127,119 @@ private:
   CubeTesselator& operator=(const CubeTesselator&);
 };
 
+/*
+ * Rigid motion of the cube grid which takes a piece from its canonical
+ * pose to one of its placements.  The rotation selects one of the 24
+ * orientations, and the translation follows in units of the cell size.
+ */
+struct PiecePose
+{
+  unsigned char rotation;
+  signed char   offset[3];
+};
+
+// Return the canonical pose of the piece, which all of its placements
+// share, and set the pose that carries it over to the placement.
+Cube find_piece_pose(Cube piece, PiecePose& pose);
+
+// Build the model matrix of the pose, for geometry of the given cell size.
+Math::Matrix4 get_pose_matrix(const PiecePose& pose, float cellsize);
+
+// Build the texture matrix of the flat faces of the given direction, which
+// lines up their texture with the cube grid once the pose is applied.
+Math::Matrix4 get_pose_texture_matrix(const PiecePose& pose, int face);
+
+// Convert the elements of geometry of the given cell size to the packed
+// format, and append them to the output array.
+void pack_elements(const CubeElementArray& elements, float cellsize,
+                   PackedElementArray& packed);
+
+// Count the vertices which a FIFO post-transform cache of the given size
+// misses when the indexed triangles are drawn in order.
+int count_vertex_cache_misses(const CubeIndex* indices, int count, int cache_size);
+
+// Reorder the indexed triangles so that consecutive ones reuse the
+// vertices still in the post-transform cache.  Each triangle keeps its
+// winding, only the order in which the triangles are drawn changes.
+void optimize_vertex_cache(CubeIndex* indices, int count);
+
+/*
+ * Least recently used cache of indexed piece geometry, keyed on the piece
+ * placement.  Pieces which are tesselated in their canonical pose need
+ * just one entry per shape, and never have to run the tesselator twice.
+ */
+class TesselationCache
+{
+public:
+  explicit TesselationCache(unsigned int memory_limit = 4 << 20);
+  ~TesselationCache();
+
+  // Changing the cell size or the edge slices empties the cache.
+  void set_cellsize(float value);
+  float get_cellsize() const { return cellsize_; }
+
+  void set_edge_slices(int value);
+  int get_edge_slices() const { return edge_slices_; }
+
+  void set_memory_limit(unsigned int bytes);
+  unsigned int get_memory_limit() const { return memory_limit_; }
+  unsigned int get_memory_usage() const { return memory_usage_; }
+
+  void clear();
+
+  // Tesselate the pieces not in the cache yet, distributed to n_threads
+  // threads if the GLib thread system has been initialized.
+  void prefetch(const std::vector<Cube>& pieces, int n_threads);
+
+  // Append the packed elements and indices of the piece to the arrays, with
+  // the indices offset to match, and return the number of triangles.  The
+  // elements must not exceed the range of CubeIndex.  The counts of indices
+  // after the flat faces of each direction are stored to face_ends.
+  int append(Cube piece, PackedElementArray& elements, CubeIndexArray& indices,
+             unsigned int* face_ends);
+
+  int get_hit_count()  const { return hit_count_; }
+  int get_miss_count() const { return miss_count_; }
+
+private:
+  struct Entry
+  {
+    PackedElementArray  elements;
+    CubeIndexArray      indices;  // relative to the first element
+    int                 face_ends[CUBE_FACE_COUNT];
+    int                 triangle_count;
+  };
+
+  struct Job;
+
+  typedef std::list<std::pair<Cube, Entry> >                     EntryList;
+  typedef std::map<Cube, EntryList::iterator, Cube::SortPredicate> EntryMap;
+
+  CubeTesselator    tesselator_;
+  CubeElementArray  element_scratch_;
+  CubeIndexArray    index_scratch_;
+  EntryList         entries_;   // most recently used first
+  EntryMap          index_;
+  float             cellsize_;
+  int               edge_slices_;
+  unsigned int      memory_limit_;
+  unsigned int      memory_usage_;
+  int               hit_count_;
+  int               miss_count_;
+
+  // noncopyable
+  TesselationCache(const TesselationCache&);
+  TesselationCache& operator=(const TesselationCache&);
+
+  static unsigned int entry_size(const Entry& entry);
+  static void optimize_entry(Entry& entry);
+  static void execute_job(void* data, void* user_data);
+
+  EntryList::iterator lookup(Cube piece);
+  EntryList::iterator insert(Cube piece, Entry& entry);
+  void trim(unsigned int limit);
+};
+
 } // namespace Somato
 
 #endif /* SOMATO_TESSELATE_H_INCLUDED */